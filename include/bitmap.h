@@ -42,8 +42,9 @@ public:
     /// Load an EXR or PNG file with the specified filename
     Bitmap(const filesystem::path &filename);
 
-    /// Save the bitmap with the specified filename according to its extension
-    void save(const filesystem::path &filename, bool flip=false);
+    /** Save the bitmap with the specified filename according to its extension.
+      * PNG files are clamped to 8 bits, and encoded in sRGB if \a srgb is true */
+    void save(const filesystem::path &filename, bool flip=false, bool srgb=false);
 
 protected:
 
@@ -57,7 +58,7 @@ protected:
     void saveEXR(const std::string &filename);
 
     /// Save the bitmap as an PNG file with the specified filename
-    void savePNG(const std::string &filename, bool flip);
+    void savePNG(const std::string &filename, bool flip, bool srgb);
 };
 
 #endif /* __NORI_BITMAP_H */
@@ -27,6 +27,8 @@
 #include "bitmap.h"
 #include "vector.h"
 #include <mutex>
+#include <atomic>
+#include <chrono>
 
 #ifdef _OPENMP
 # include <omp.h>
@@ -131,7 +133,13 @@ public:
     /// Clear all contents
     void clear() { setConstant(Color4f()); }
 
-    /// Record a sample with the given position and radiance value
+    /**
+     * \brief Record a sample with the given position and radiance value
+     *
+     * The position is given in continuous pixel coordinates of the whole
+     * image, the sample is accumulated (with weight 1) in the pixel it
+     * falls into, i.e. pixel (x,y) covers [x,x+1)x[y,y+1).
+     */
     void put(const Vector2f &pos, const Color3f &value);
 
     /**
@@ -185,6 +193,15 @@ public:
      */
     bool next(ImageBlock &block);
 
+    /**
+     * \brief Return the offset and size of the next block to be rendered
+     *
+     * This function is thread-safe
+     *
+     * \return \c false if there were no more blocks
+     */
+    bool next(Point2i &offset, Vector2i &size);
+
     /// Return the total number of blocks
     int getBlockCount() const { return m_blocksLeft; }
 protected:
@@ -201,4 +218,93 @@ protected:
     MutexType m_mutex;
 };
 
+/**
+ * \brief Lock-free work-stealing block scheduler
+ *
+ * The blocks produced by a \ref BlockGenerator are dealt round-robin
+ * to one deque per worker thread, so that each worker starts near the
+ * center of the image and proceeds in spiral order. A worker pops blocks
+ * from the front of its own deque; once it is empty, it steals from the
+ * back of the fullest deque of the other workers. The set of blocks is
+ * fixed at construction, so a deque is simply a [head, tail) range packed
+ * into a single atomic word and updated with compare-and-swap.
+ *
+ * The scheduler also measures, for each worker, the time spent rendering
+ * blocks (busy) and the time spent waiting for the frame to end (idle).
+ */
+class BlockScheduler {
+public:
+    /// Per-worker statistics (times are in milliseconds)
+    struct WorkerStats {
+        int blockCount = 0;
+        int stolenCount = 0;
+        double busyTime = 0;
+        double idleTime = 0;
+    };
+
+    /**
+     * \brief Create a block scheduler
+     * \param size
+     *      Size of the image that should be split into blocks
+     * \param blockSize
+     *      Maximum size of the individual blocks
+     * \param workerCount
+     *      Number of worker threads that will call \ref next()
+     */
+    BlockScheduler(const Vector2i &size, int blockSize, int workerCount);
+
+    /**
+     * \brief Return the next block to be rendered by worker \a workerId
+     *
+     * This function is thread-safe and lock-free, but a given
+     * \a workerId must only be used by one thread at a time.
+     *
+     * \return \c false if there were no more blocks in the whole image
+     */
+    bool next(int workerId, ImageBlock &block);
+
+    /// Return the total number of blocks
+    int getBlockCount() const { return (int) m_blocks.size(); }
+
+    /// Return the number of workers
+    int getWorkerCount() const { return (int) m_workers.size(); }
+
+    /// Return the statistics of all workers (only valid once all of them are done)
+    std::vector<WorkerStats> getStatistics() const;
+
+    /// Return a human-readable summary of the per-worker statistics
+    std::string toString() const;
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Block {
+        Point2i offset;
+        Vector2i size;
+    };
+
+    struct alignas(64) Worker {
+        /// Remaining blocks of the worker: head in the high, tail in the low 32 bits
+        std::atomic<uint64_t> range;
+        WorkerStats stats;
+        Clock::time_point lastTime;
+        Clock::time_point endTime;
+        bool busy = false;
+    };
+
+    static uint64_t pack(uint32_t head, uint32_t tail) { return (uint64_t(head) << 32) | tail; }
+    static uint32_t head(uint64_t range) { return uint32_t(range >> 32); }
+    static uint32_t tail(uint64_t range) { return uint32_t(range); }
+
+    /// Pop a block from the front of the deque of \a worker, returns -1 if it is empty
+    int popFront(Worker &worker);
+
+    /// Steal a block from the back of the deque of \a worker, returns -1 if it is empty
+    int popBack(Worker &worker);
+
+    std::vector<Block> m_blocks;
+    std::vector<Worker> m_workers;
+    Clock::time_point m_startTime;
+};
+
 #endif /* __NORI_PARALLEL_H */
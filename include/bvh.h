@@ -3,10 +3,13 @@
 #define BVH_H
 
 #include <Eigen/Geometry>
+#include <atomic>
+#include <string>
 #include <vector>
-#include <nanogui/glutil.h>
 #include "ray.h"
+#include "trianglepacket.h"
 class Mesh;
+namespace nanogui { class GLShader; }
 
 class BVH
 {
@@ -23,27 +26,217 @@ class BVH
 
     typedef std::vector<Node> NodeList;
 
+    /// Nearest triangle found by a traversal, only stored in the hit once the traversal is over
+    struct TriangleHit {
+        int index = -1; // in m_faces
+        float u = 0.f;
+        float v = 0.f;
+    };
+
+    /** Node of a wide BVH, obtained by collapsing the binary tree, whose child boxes
+      * are stored in SoA layout to be tested together with SIMD instructions */
+    template <int Width> struct WideNode {
+        static constexpr int ChildCount = Width;
+        static constexpr bool Quantized = false;
+
+        /// boxes of the children: minimal x, y, z then maximal x, y, z coordinates
+        alignas(32) float bounds[6][Width];
+        /// index of the child node, or ~(index of its first face) for a leaf
+        int children[Width];
+        /// number of faces of the leaf children (0 for inner and empty children)
+        unsigned short nb_faces[Width];
+
+        /// \returns the index of the i-th child node, or -1 for a leaf whose faces are [first, first+count)
+        int child(int i, int& first, int& count) const {
+            if (children[i] >= 0)
+                return children[i];
+            first = ~children[i];
+            count = nb_faces[i];
+            return -1;
+        }
+    };
+
+    /** Compact wide node, whose child boxes are quantized to 8 bits in the frame of the node's box,
+      * and whose leaves are packed with their number of faces: 24 + 10 * Width bytes instead of 32 * Width */
+    template <int Width> struct QuantizedNode {
+        static constexpr int ChildCount = Width;
+        static constexpr bool Quantized = true;
+        /// number of bits of the number of faces of a packed leaf
+        static constexpr int LeafSizeBits = 5;
+
+        /// the child boxes are origin + bounds * scale, rounded outwards
+        float origin[3];
+        float scale[3];
+        /// quantized boxes of the children: minimal x, y, z then maximal x, y, z coordinates
+        uint8_t bounds[6][Width];
+        /// index of the child node, or ~(first face << LeafSizeBits | (number of faces - 1)) for a leaf
+        int children[Width];
+
+        int child(int i, int& first, int& count) const {
+            if (children[i] >= 0)
+                return children[i];
+            first = ~children[i] >> LeafSizeBits;
+            count = (~children[i] & ((1 << LeafSizeBits) - 1)) + 1;
+            return -1;
+        }
+    };
+
 public:
 
-    void build(const Mesh* pMesh, int targetCellSize, int maxDepth);
+    /// Strategies to split the faces of an inner node
+    enum SplitMethod {
+        /// Split at the middle of the largest axis of the node's box
+        SplitMidpoint,
+        /// Binned surface area heuristic: split where the expected cost of a ray traversal is the lowest
+        SplitSAH
+    };
+
+    /// Summary of the shape of the tree and of its expected traversal cost
+    struct Statistics {
+        int nodeCount = 0;
+        int leafCount = 0;
+        int maxDepth = 0;
+        int maxLeafSize = 0;
+        /// Expected cost of a ray traversal (in ray/triangle tests), according to the SAH
+        float sahCost = 0.f;
+    };
+
+    /// Number of BVH nodes visited by the calling thread
+    static thread_local long int ms_node_count;
+
+    /** Build the hierarchy of the faces of \a pMesh, using all the cores for the large meshes.
+      * With the midpoint strategy, the nodes are split until they contain at most \a targetCellSize faces.
+      * With the SAH, a node is a leaf when this is cheaper than splitting it, and it has at most \a targetCellSize faces.
+      * With a \a width of 4 or 8, the binary tree is then collapsed into a wide tree whose nodes have
+      * up to \a width children, which are tested together by the traversal. If \a compressed is true,
+      * the nodes of the wide tree are quantized (see QuantizedNode), which halves its size or more.
+      */
+    void build(const Mesh* pMesh, int targetCellSize, int maxDepth, SplitMethod method = SplitSAH, int width = 2,
+               bool compressed = false);
+    /** Search for the nearest intersection between \a ray and the faces of the mesh, within the interval of the ray,
+      * which is closer than \a hit. The tree is traversed iteratively, nearest child first, with precomputed inverse
+      * ray directions, the subtrees behind the closest hit found so far being skipped.
+      * \returns true if \a hit has been updated
+      */
     bool intersect(const Ray& ray, Hit& hit) const;
 
+    /** \returns true if \a ray intersects a face of the mesh within its interval. The traversal stops
+      * at the first leaf with such a face, without ordering the children nor searching for the nearest one.
+      */
+    bool occluded(const Ray& ray) const;
+
+    /// \returns the statistics of the binary tree
+    const Statistics& getStatistics() const { return m_statistics; }
+
+    /// \returns the number of children of the nodes of the tree (2, 4 or 8)
+    int getWidth() const { return m_width; }
+
+    /// \returns the memory used by the tree (nodes, face indices and triangles) in bytes
+    size_t getMemoryUsage() const;
+
+    /// \returns the duration of the construction (or of the loading) of the tree in milliseconds
+    float getBuildTime() const { return m_buildTime; }
+
+    /// \returns true if the tree has been loaded from the cache instead of being built
+    bool isFromCache() const { return m_fromCache; }
+
+    /** Set the directory in which the trees are saved once built, to be loaded instead of rebuilt when
+      * the same mesh is built again with the same parameters, in this or a later session. The cache
+      * is disabled if \a directory is empty, which is the default unless the MDS3D_BVH_CACHE
+      * environment variable is set.
+      */
+    static void setCacheDirectory(const std::string& directory);
+
+    /// \returns the directory of the cache of the trees, or an empty string if it is disabled
+    static const std::string& getCacheDirectory();
+
+    /// Return a human-readable summary of the tree
+    std::string toString() const;
+
     void draw(nanogui::GLShader* prg, int maxDepth) const;
 
 protected:
 
-    bool intersectNode(int nodeId, const Ray& ray, Hit& hit) const;
+    /* The following functions process the faces in \a chunkCount chunks in parallel,
+       or serially without allocating any memory if \a chunkCount is 1. */
+
+    int split(int start, int end, int dim, float split_value, int chunkCount);
+
+    /// Compute the bounding box of the faces [start,end) and the bounding box of their centroids
+    void computeBounds(int start, int end, int chunkCount, Eigen::AlignedBox3f& box, Eigen::AlignedBox3f& centroidBox) const;
+
+    /** Find the split of the faces [start,end) of a node of bounding box \a box with the lowest SAH cost.
+      * \returns false if the centroids cannot be split, otherwise \a dim, \a split_value and \a cost are set
+      */
+    bool findSAHSplit(int start, int end, int chunkCount, const Eigen::AlignedBox3f& box, const Eigen::AlignedBox3f& centroidBox,
+                      int& dim, float& split_value, float& cost) const;
+
+    /** Build the subtree of \a nodeId from the faces [start,end).
+      * \a concurrent is true within a subtree built concurrently with another one: its loops are then serial,
+      * so that the number of threads stays bounded by the number of cores */
+    void buildNode(int nodeId, int start, int end, int level, int targetCellSize, int maxDepth, bool concurrent = false);
+
+    Statistics computeStatistics() const;
+
+    /// Collapse the binary subtree of \a nodeId into \a wideNodes. \returns the index of its wide node
+    template <int Width> int collapse(std::vector<WideNode<Width>>& wideNodes, int nodeId) const;
 
-    int split(int start, int end, int dim, float split_value);
+    /// Convert \a wideNodes into compact nodes
+    template <int Width> void quantize(const std::vector<WideNode<Width>>& wideNodes, std::vector<QuantizedNode<Width>>& quantizedNodes) const;
 
-    void buildNode(int nodeId, int start, int end, int level, int targetCellSize, int maxDepth);
+    template <typename WideNodeType> bool intersectWide(const std::vector<WideNodeType>& wideNodes, const Ray& ray, Hit& hit) const;
+
+    template <typename WideNodeType> bool occludedWide(const std::vector<WideNodeType>& wideNodes, const Ray& ray) const;
+
+    /// Pad m_faces with -1 so that the faces of every leaf start on a packet of triangles
+    void alignLeaves();
+
+    /// Compute m_packets from the faces of the mesh, in the order of m_faces
+    void buildPackets();
+
+    /** Intersect \a ray with the faces [first, first+count) of a leaf, only updating \a triangleHit and the distance
+      * \a tMax, which is the end of the interval of the ray tightened by the hits found so far, if closer */
+    bool intersectTriangles(const Ray& ray, int first, int count, float& tMax, TriangleHit& triangleHit) const;
+
+    /// \returns true if \a ray intersects one of the faces [first, first+count) of a leaf within its interval
+    bool occludedTriangles(const Ray& ray, int first, int count) const;
 
     void drawNode(nanogui::GLShader* prg, int id, int maxDepth, int currentDepth) const;
 
+    /// \returns the key in the cache of the tree of the faces of the mesh built with these parameters
+    uint64_t cacheKey(int targetCellSize, int maxDepth, SplitMethod method, int width, bool compressed) const;
+
+    /// Load the tree of key \a key saved in \a filename. \returns false if the file is missing, does not match or is corrupt
+    bool load(const std::string& filename, uint64_t key);
+
+    /// \returns true if the indices of the loaded tree are within its arrays, so that it can be traversed safely
+    bool isValid() const;
+
+    /// Save the tree in \a filename, under the key \a key
+    void save(const std::string& filename, uint64_t key) const;
+
     const Mesh* m_pMesh;
-    NodeList m_nodes;
-    std::vector<int> m_faces;
+    SplitMethod m_method = SplitSAH;
+    int m_width = 2;
+    NodeList m_nodes;                          // binary tree, only kept for a width of 2
+    std::vector<WideNode<4>> m_wideNodes4;
+    std::vector<WideNode<8>> m_wideNodes8;
+    std::vector<QuantizedNode<4>> m_quantizedNodes4;
+    std::vector<QuantizedNode<8>> m_quantizedNodes8;
+    bool m_compressed = false;
+    size_t m_binaryMemoryUsage = 0;
+    Eigen::AlignedBox3f m_box;
+    std::vector<int> m_faces;                  // faces in leaf order, each leaf padded to a packet
+    std::vector<TrianglePacket> m_packets;     // precomputed edges of m_faces, tested together by the leaves
+    Statistics m_statistics;
+    float m_buildTime = 0.f;
+    bool m_fromCache = false;
+    // data used during the construction only
     std::vector<Point3f> m_centroids;
+    std::vector<Eigen::AlignedBox3f> m_faceBoxes;
+    std::vector<int> m_scratch;
+    std::atomic<int> m_nodeCount;
+    std::atomic<int> m_buildThreads;
 };
 
 #endif
@@ -25,9 +25,10 @@
 #include "common.h"
 #include "object.h"
 
-#include <nanogui/glutil.h>
 #include <Eigen/Geometry>
 
+namespace nanogui { class GLShader; }
+
 /// Represents a 3D frame, i.e. an orthogonal basis with the position of the origin.
 class Frame
 {
@@ -30,6 +30,7 @@
 #include <iostream>
 #include <algorithm>
 #include <vector>
+#include <thread>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <stdint.h>
@@ -102,6 +103,55 @@ typedef Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> MatrixXu;
 /// Return the number of cores (real and virtual)
 extern int getCoreCount();
 
+/// Return the number of chunks of at least \a grainSize elements, one per core at most, to process \a size elements in parallel
+inline int getChunkCount(int size, int grainSize) {
+    return std::max(1, std::min(getCoreCount(), size / std::max(grainSize, 1)));
+}
+
+/**
+ * \brief Split the range [begin,end) into \a chunkCount contiguous chunks and process them in parallel
+ *
+ * \a f(chunk, chunkBegin, chunkEnd) is called once per chunk, the first chunk on the
+ * calling thread and the others on their own threads. The function returns once
+ * all the chunks have been processed.
+ */
+template <typename Func> void parallelChunks(int begin, int end, int chunkCount, const Func &f) {
+    auto bound = [&](int chunk) { return begin + int(int64_t(end - begin) * chunk / chunkCount); };
+    std::vector<std::thread> threads;
+    for (int chunk = 1; chunk < chunkCount; ++chunk)
+        threads.emplace_back([&f, chunk, first = bound(chunk), last = bound(chunk + 1)]() { f(chunk, first, last); });
+    f(0, begin, bound(1));
+    for (auto &thread : threads)
+        thread.join();
+}
+
+/// Compute a 64 bits hash of \a size bytes, which can be chained by passing the previous hash as \a seed
+extern uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+/**
+ * \brief Read-only memory mapping of a whole file
+ *
+ * The pages are only loaded when they are accessed. On the platforms without
+ * mmap(), the file is read into memory instead.
+ */
+class MappedFile {
+public:
+    /// Map \a filename, throws an RTException if it cannot be opened
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    std::vector<char> m_buffer; // content of the file when it cannot be mapped
+};
+
 /// Indent a string by the specified number of spaces
 extern std::string indent(const std::string &string, int amount = 2);
 
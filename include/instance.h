@@ -0,0 +1,35 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "shape.h"
+#include "transform.h"
+
+#include <memory>
+
+class Mesh;
+
+/** Placement of a mesh, transformed by "toWorld": the mesh of the file "filename" and its BVH are loaded once
+  * and shared by all the instances of this file (see Mesh::loadShared()), the rays being moved into the space
+  * of the mesh to be intersected. Each instance has its own material.
+  */
+class Instance : public Shape
+{
+public:
+    Instance(const PropertyList &propList);
+
+    virtual bool intersect(const Ray& ray, Hit& hit) const;
+    virtual bool occluded(const Ray& ray) const;
+    virtual void computeSurfaceInteraction(const Ray& ray, Hit& hit) const;
+    virtual const Eigen::AlignedBox3f& AABB() const { return m_AABB; }
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+protected:
+    std::shared_ptr<const Mesh> m_mesh;
+    Transform m_toWorld;
+    Transform m_toObject;
+    Eigen::AlignedBox3f m_AABB;
+};
+
+#endif // INSTANCE_H
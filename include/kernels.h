@@ -0,0 +1,60 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct TrianglePacket;
+struct SpherePacket;
+
+/**
+ * \brief Hot kernels of the raytracer, compiled for several instruction sets
+ *
+ * Every variant is built from the same source (src/kernels.inl) with the flags of its
+ * instruction set, and the best one supported by the CPU is selected once, at startup,
+ * from CPUID. The MDS3D_ISA environment variable (generic, sse4.2, avx2 or avx512) forces
+ * a lower instruction set. The kernels only take plain arrays: vectors are given as 3 floats.
+ */
+struct Kernels
+{
+    /// Name of the instruction set of the kernels
+    const char* isa;
+
+    /** Slab test between a ray and the 4 (resp. 8) boxes stored in SoA layout in \a bounds (minimal x, y, z then
+      * maximal x, y, z coordinates), \a sign being the signs of the inverse direction of the ray.
+      * \returns the bit mask of the boxes entered before \a tMax, their entry distances being returned in \a tNear */
+    int (*intersectBoxes4)(const float (*bounds)[4], const float* origin, const float* invDirection, const int* sign,
+                           float tMax, float* tNear);
+    int (*intersectBoxes8)(const float (*bounds)[8], const float* origin, const float* invDirection, const int* sign,
+                           float tMax, float* tNear);
+
+    /** Same test for boxes quantized to 8 bits, whose coordinates are \a boxOrigin + \a bounds * \a scale
+      * along each axis (see BVH::QuantizedNode) */
+    int (*intersectQuantizedBoxes4)(const uint8_t (*bounds)[4], const float* boxOrigin, const float* scale,
+                                    const float* origin, const float* invDirection, const int* sign, float tMax, float* tNear);
+    int (*intersectQuantizedBoxes8)(const uint8_t (*bounds)[8], const float* boxOrigin, const float* scale,
+                                    const float* origin, const float* invDirection, const int* sign, float tMax, float* tNear);
+
+    /// See intersectTrianglePackets()
+    int (*intersectTriangles)(const TrianglePacket* packets, int count, const float* origin, const float* direction,
+                              float tMin, float& t, float& u, float& v);
+
+    /// See intersectSpherePackets()
+    int (*intersectSpheres)(const SpherePacket* packets, int count, const float* origin, const float* direction,
+                            float tMin, float& t);
+
+    /** Convert \a count linear color components in 8 bits values, clamped to [0,1],
+      * and encoded in sRGB if \a srgb is true */
+    void (*tonemap)(const float* values, size_t count, uint8_t* result, bool srgb);
+};
+
+/// Kernels selected at startup, see kernels()
+extern const Kernels* const selectedKernels;
+
+/// \returns the kernels of the best instruction set supported by the CPU
+inline const Kernels& kernels()
+{
+    return *selectedKernels;
+}
+
+#endif // KERNELS_H
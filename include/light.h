@@ -4,8 +4,6 @@
 #include "object.h"
 #include "bitmap.h"
 
-#include <nanogui/glutil.h>
-
 class Light : public Object
 {
 public:   
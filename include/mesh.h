@@ -7,9 +7,9 @@
 #include "shape.h"
 #include "bvh.h"
 
+#include <memory>
 #include <vector>
 #include <string>
-#include <nanogui/glutil.h>
 
 /** \class Mesh
   * A class to represent a 3D triangular mesh
@@ -17,7 +17,8 @@
 class Mesh : public Shape
 {
 public:
-    static long int ms_itersection_count;
+    /// Number of ray/triangle tests performed by the calling thread
+    static thread_local long int ms_itersection_count;
 
     /** Represents a vertex of the mesh */
     struct Vertex
@@ -43,6 +44,11 @@ public:
     /** Destructor */
     virtual ~Mesh();
 
+    /** \returns the mesh of the file "filename" of \a propList, built with the BVH parameters of \a propList as
+      * the constructor does. It is only loaded once: the shapes (e.g. the instances) requesting the same file with
+      * the same parameters share it, as long as one of them holds it. */
+    static std::shared_ptr<const Mesh> loadShared(const PropertyList &propList);
+
     void loadFromFile(const std::string& filename);
 
     /** Loads a triangular mesh in the OFF format */
@@ -50,12 +56,31 @@ public:
 
     /** Loads a triangular mesh in the OBJ format */
     void loadOBJ(const std::string& filename);
+
+    /** Loads a triangular mesh in the PLY format (ASCII or binary), with its possible normals
+      * (nx, ny, nz properties) and texture coordinates (u, v or s, t properties) */
+    void loadPLY(const std::string& filename);
+
+    /** Maps a triangular mesh in the binary format written by saveBinary(), whose vertices and faces
+      * are used in place, without any parsing nor copy */
+    void loadBinary(const std::string& filename);
+
+    /** Saves the mesh in the binary format: a header holding the bounding box and the number of vertices
+      * and faces, followed by the vertices (position, normal, texture coordinates) and the vertex indices
+      * of the faces, both aligned to 64 bytes so that they can be mapped in memory as is */
+    void saveBinary(const std::string& filename) const;
     
     void loadRawData(float* positions, int nbVertices, int* indices, int nbTriangles); 
     
     virtual bool intersect(const Ray& ray, Hit& hit) const;
+    virtual bool occluded(const Ray& ray) const;
+
+    /// Interpolate the normal and the texture coordinates of the vertices at the barycentric coordinates of \a hit
+    virtual void computeSurfaceInteraction(const Ray& ray, Hit& hit) const;
 
-    /** compute the intersection between a ray and a given triangular face */
+    /** compute the intersection between a ray and a given triangular face,
+      * \a hit is only updated (and true returned) if the intersection is closer than \a hit.t(),
+      * its primitive is then the face and its barycentric coordinates are those of the intersection */
     bool intersectFace(const Ray& ray, Hit& hit, int faceId) const;
 
     void makeUnitary();
@@ -63,10 +88,13 @@ public:
     void buildBVH();
 
     /// \returns  the number of faces
-    int nbFaces() const { return m_faces.size(); }
+    int nbFaces() const { return m_nbFaces; }
+
+    /// \returns the number of vertices
+    int nbVertices() const { return m_nbVertices; }
 
     /// \returns a const references to the \a vertexId -th vertex of the \a faceId -th face. vertexId must be between 0 and 2 !!
-    const Vertex& vertexOfFace(int faceId, int vertexId) const { return m_vertices[m_faces[faceId](vertexId)]; }
+    const Vertex& vertexOfFace(int faceId, int vertexId) const { return m_vertexData[m_faceData[faceId](vertexId)]; }
 
     virtual const Eigen::AlignedBox3f& AABB() const { return m_AABB; }
 
@@ -86,15 +114,36 @@ protected:
     /** Represents a sequential list of triangles */
     typedef std::vector<FaceIndex> FaceIndexArray;
 
-    /** The list of vertices */
+    /** Point m_vertexData and m_faceData to m_vertices and m_faces, after they have been filled */
+    void useArrays();
+
+    /** Copy the vertices and faces of the mapped file into m_vertices and m_faces, to modify them */
+    void unmap();
+
+    /** The list of vertices (empty if the mesh is mapped from a binary file) */
     VertexArray m_vertices;
-    /** The list of face indices */
+    /** The list of face indices (empty if the mesh is mapped from a binary file) */
     FaceIndexArray m_faces;
 
+    /** The vertices and faces of the mesh, stored in the arrays above or in the mapped file */
+    const Vertex* m_vertexData = nullptr;
+    const FaceIndex* m_faceData = nullptr;
+    int m_nbVertices = 0;
+    int m_nbFaces = 0;
+    /** The number of vertices read from the file, before the identical ones are welded */
+    int m_nbLoadedVertices = 0;
+    std::unique_ptr<MappedFile> m_file;
+
     /** The bounding box of the mesh */
     Eigen::AlignedBox3f m_AABB;
 
-    BVH* m_BVH;
+    BVH* m_BVH = nullptr;
+    /** The split strategy of the BVH ("bvh" property: "sah" or "midpoint") */
+    BVH::SplitMethod m_bvhSplit = BVH::SplitSAH;
+    /** The number of children of the nodes of the BVH ("bvhWidth" property: 2, 4 or 8) */
+    int m_bvhWidth = 2;
+    /** Whether the wide BVH nodes are quantized ("bvhCompressed" property) */
+    bool m_bvhCompressed = false;
 };
 
 #endif
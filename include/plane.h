@@ -14,6 +14,7 @@ public:
     virtual ~Plane();
 
     virtual bool intersect(const Ray& ray, Hit& hit) const;
+    virtual void computeSurfaceInteraction(const Ray& ray, Hit& hit) const;
 
     /// Return a human-readable summary
     std::string toString() const {
@@ -9,19 +9,27 @@ class Shape;
 class Ray
 {
 public:
-    Ray(const Point3f& o, const Vector3f& d)
-        : origin(o), direction(d), recursionLevel(0)
+    Ray(const Point3f& o, const Vector3f& d, float tMin = 0.f, float tMax = std::numeric_limits<float>::max())
+        : origin(o), direction(d), tMin(tMin), tMax(tMax), recursionLevel(0)
     {}
-    Ray() : recursionLevel(0) {}
+    Ray() : tMin(0.f), tMax(std::numeric_limits<float>::max()), recursionLevel(0) {}
 
     Point3f origin;
     Vector3f direction;
+    /// Only the intersections strictly between tMin and tMax are searched, e.g. to leave the surface
+    /// the ray starts from or to stop at a light
+    float tMin, tMax;
 
     Point3f at(float t) const { return origin + t*direction; }
 
     int recursionLevel;   ///< recursion level (used as a stoping critera)
 };
 
+/** Intersection between a ray and the scene.
+  * During the traversal, the shapes only record the distance, the primitive and the barycentric
+  * coordinates of their nearest hit; the normal and texture coordinates of the surface are then
+  * computed once, for the nearest shape only, by Shape::computeSurfaceInteraction().
+  */
 class Hit
 {
 public:
@@ -35,18 +43,25 @@ public:
     void setShape(const Shape* shape) { m_shape = shape; }
     const Shape* shape() const { return m_shape; }
 
+    /// Set the primitive (e.g. the face of a mesh) hit by the ray, and the barycentric coordinates of the hit on it
+    void setPrimitive(int id, float u = 0.f, float v = 0.f) { m_primitive = id; m_barycentric = {u,v}; }
+    int primitive() const { return m_primitive; }
+    const Vector2f& barycentric() const { return m_barycentric; }
+
     void setNormal(const Normal3f& n) { m_normal = n; }
     const Normal3f& normal() const { return m_normal; }
 
     void setTextCoord(float u, float v) { m_textCoord = {u,v}; }
-    Vector2f TextCoord() { return m_textCoord; }
+    Vector2f TextCoord() const { return m_textCoord; }
 
 private:
     Normal3f m_normal;
     const Shape* m_shape;
     float m_t;
+    int m_primitive = -1;
+    Vector2f m_barycentric = Vector2f::Zero();
     // Used to store the uv texture coordinates
-    Vector2f m_textCoord;
+    Vector2f m_textCoord = Vector2f::Zero();
 };
 
 /** Compute the intersection between a ray and an aligned box
@@ -0,0 +1,28 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "scene.h"
+#include "block.h"
+
+#include <atomic>
+
+/** Options of the raytracer */
+struct RenderOptions
+{
+    /// Number of rendering threads (0 means one per core)
+    int nbThreads = 0;
+    /// Render the image in passes of one sample per pixel, instead of tile by tile
+    bool progressive = false;
+    /// If not null, the rendering stops as soon as possible once it is set to true
+    const std::atomic<bool>* stop = nullptr;
+};
+
+/** Raytrace \a scene into the image block \a result, which must have been cleared.
+  * The image is split into tiles rendered in parallel, the samples being accumulated in \a result.
+  * \a done is set to true once the whole image has been rendered (or the rendering was stopped).
+  * \returns the number of samples rendered, which differs from the sample count of the
+  * camera times the number of pixels in adaptive sampling (see Sampler).
+  */
+long render(Scene* scene, ImageBlock* result, std::string outputName, std::atomic<bool>* done, RenderOptions options);
+
+#endif // RENDER_H
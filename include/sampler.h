@@ -0,0 +1,150 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "object.h"
+#include "vector.h"
+
+/**
+ * \brief Small PCG32 pseudo-random number generator
+ *
+ * See http://www.pcg-random.org. Its state is 16 bytes, so that each
+ * rendering thread can cheaply reseed its own copy for every pixel.
+ */
+class PCG32
+{
+public:
+    PCG32(uint64_t initstate = 0x853c49e6748fea9bULL, uint64_t initseq = 0xda3e39cb94b95bdbULL) { seed(initstate, initseq); }
+
+    void seed(uint64_t initstate, uint64_t initseq = 1) {
+        m_state = 0U;
+        m_inc = (initseq << 1u) | 1u;
+        nextUInt();
+        m_state += initstate;
+        nextUInt();
+    }
+
+    /// \returns a uniformly distributed 32 bits integer
+    uint32_t nextUInt() {
+        uint64_t oldstate = m_state;
+        m_state = oldstate * 0x5851f42d4c957f2dULL + m_inc;
+        uint32_t xorshifted = (uint32_t) (((oldstate >> 18u) ^ oldstate) >> 27u);
+        uint32_t rot = (uint32_t) (oldstate >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+
+    /// \returns a uniformly distributed float in [0,1)
+    float nextFloat() {
+        return std::min(float(nextUInt()) * 0x1p-32f, 0x1.fffffep-1f);
+    }
+
+private:
+    uint64_t m_state;
+    uint64_t m_inc;
+};
+
+/**
+ * \brief Abstract sample generator
+ *
+ * A sampler generates the (possibly low-discrepancy) sample positions used
+ * to integrate over the pixels of the image. The number of samples per pixel
+ * is given by the camera (see Camera::sampleCount()). The render threads each use
+ * their own clone of the scene's sampler, and call \ref startPixel() before
+ * generating the samples of a pixel, then \ref advance() after each sample.
+ * A sample only depends on its pixel and index, not on the thread rendering
+ * it nor on the previous samples: a progressive rendering, which generates
+ * one sample per pixel and per pass, gives the same image.
+ *
+ * Within a sample, successive calls to \ref next1D() and \ref next2D()
+ * consume the dimensions of the sample: the first 2D sample is the
+ * position within the pixel.
+ *
+ * Every sampler also supports adaptive sampling, enabled by a positive
+ * \c threshold property: the renderer then stops sampling a pixel once the
+ * relative standard error of its mean luminance falls below the threshold
+ * (after at least \c minSamples samples), and spends the samples saved on
+ * the noisy pixels, up to \c maxSamples samples per pixel (4 times the
+ * sample count by default).
+ */
+class Sampler : public Object
+{
+public:
+    virtual ~Sampler() { }
+
+    /// Create an independent copy of this sampler (for another thread)
+    virtual Sampler *clone() const = 0;
+
+    /// Set the number of samples per pixel (implementations may round it)
+    virtual void setSampleCount(int sampleCount) { m_sampleCount = std::max(sampleCount, 1); }
+
+    /// \returns the number of samples per pixel
+    int getSampleCount() const { return m_sampleCount; }
+
+    /// \returns true if the number of samples is adapted to the noise of each pixel
+    bool isAdaptive() const { return m_threshold > 0.f; }
+
+    /// \returns the relative error below which a pixel is considered as converged
+    float getThreshold() const { return m_threshold; }
+
+    /// \returns the number of samples taken in every pixel before estimating its error
+    int getMinSampleCount() const { return std::max(1, std::min(m_minSamples, getMaxSampleCount())); }
+
+    /// \returns the maximal number of samples of a pixel in adaptive sampling
+    int getMaxSampleCount() const { return m_maxSamples > 0 ? m_maxSamples : 4 * m_sampleCount; }
+
+    /// Prepare the generation of the samples of \a pixel, starting at sample \a sampleIndex
+    virtual void startPixel(const Point2i &pixel, int sampleIndex = 0) {
+        m_pixelSeed = hash(uint32_t(pixel.x()), uint32_t(pixel.y()));
+        m_sampleIndex = sampleIndex;
+        startSample();
+    }
+
+    /// Move on to the next sample of the current pixel
+    virtual void advance() {
+        ++m_sampleIndex;
+        startSample();
+    }
+
+    /// \returns the next 1D component of the current sample, in [0,1)
+    virtual float next1D() = 0;
+
+    /// \returns the next 2D component of the current sample, in [0,1)^2
+    virtual Point2f next2D() = 0;
+
+    /// \brief Return the type of object provided by this instance
+    EClassType getClassType() const { return ESampler; }
+
+protected:
+    Sampler(const PropertyList &propList) {
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+        m_threshold = propList.getFloat("threshold", 0.f);
+        m_minSamples = propList.getInteger("minSamples", 4);
+        m_maxSamples = propList.getInteger("maxSamples", 0);
+    }
+
+    /// Reset the dimension and the random numbers for the current sample
+    void startSample() {
+        m_random.seed(hash(m_pixelSeed, uint32_t(m_sampleIndex)), m_seed);
+        m_dimension = 0;
+    }
+
+    /// Hash two integers into a well-mixed 32 bits value
+    static uint32_t hash(uint32_t a, uint32_t b) {
+        uint64_t h = (uint64_t(a) << 32) | b;
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return uint32_t(h);
+    }
+
+    int m_sampleCount = 1;
+    float m_threshold;
+    int m_minSamples;
+    int m_maxSamples;
+    uint32_t m_seed;
+    uint32_t m_pixelSeed = 0;
+    int m_sampleIndex = 0;
+    int m_dimension = 0;
+    PCG32 m_random;
+};
+
+#endif // SAMPLER_H
@@ -5,8 +5,8 @@
 #include "shape.h"
 #include "light.h"
 #include "integrator.h"
-
-#include <nanogui/glutil.h>
+#include "sampler.h"
+#include "scenebvh.h"
 
 typedef std::vector<Shape*> ShapeList;
 typedef std::vector<Light*> LightList;
@@ -25,6 +25,10 @@ public :
     Integrator* integrator() { return m_integrator; }
     const Integrator* integrator() const { return m_integrator; }
 
+    /// \return a pointer to the scene's sample generator
+    Sampler* sampler() { return m_sampler; }
+    const Sampler* sampler() const { return m_sampler; }
+
     /// \return a reference to an array containing all the shapes
     const ShapeList& shapeList() const { return m_shapeList; }
 
@@ -34,12 +38,19 @@ public :
     /// \return the background color
     Color3f backgroundColor() const { return m_backgroundColor; }
 
-    /// Search the nearest intersection between the ray and the shape list
+    /// Search the nearest intersection between the ray and the shapes within the interval of the ray,
+    /// through the hierarchy of their bounding boxes
     void intersect(const Ray& ray, Hit& hit) const;
 
+    /// \returns true if a shape intersects the ray within its interval, e.g. between a point and a light
+    bool occluded(const Ray& ray) const;
+
     /// Register a child object (e.g. a material) with the shape
     virtual void addChild(Object *child);
 
+    /// Create the default sampler if the scene does not specify one, and build the hierarchy of the shapes
+    virtual void activate();
+
     /// \brief Return the type of object provided by this instance
     EClassType getClassType() const { return EScene; }
 
@@ -55,8 +66,12 @@ private:
 
     Camera* m_camera = nullptr;
 
+    Sampler* m_sampler = nullptr;
+
     ShapeList m_shapeList;
 
+    SceneBVH m_shapeBVH;
+
     LightList m_lightList;
 
     Color3f m_backgroundColor;
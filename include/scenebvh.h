@@ -0,0 +1,84 @@
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <Eigen/Geometry>
+#include <string>
+#include <vector>
+#include "ray.h"
+#include "spherepacket.h"
+
+class Shape;
+
+/** Top level of the acceleration structure of a scene: a binary BVH over the bounding boxes of its shapes,
+  * whose leaves call the intersection of each shape (e.g. the BVH of a mesh, which is the bottom level).
+  * The spheres of a leaf are rather gathered in SoA packets, tested by SIMD kernels without any virtual call.
+  * The unbounded shapes, such as the planes, are kept aside and tested by every ray.
+  */
+class SceneBVH
+{
+    struct Node {
+        Eigen::AlignedBox3f box;
+        int first;       // first child for inner nodes, first shape for leaves
+        int count;       // number of shapes of a leaf, 0 for inner nodes
+        int nbSpheres;   // number of spheres of a leaf, which are its first shapes
+        int firstPacket; // first packet of the spheres of a leaf
+    };
+
+public:
+
+    /// Build the hierarchy of \a shapes
+    void build(const std::vector<Shape*>& shapes);
+
+    /// Release the hierarchy
+    void clear();
+
+    /** Search for the nearest intersection between \a ray and the shapes, within the interval of the ray, which is
+      * closer than \a hit, visiting the nodes nearest first. Each hit tightens the interval, so that the nodes and
+      * the shapes behind the closest hit found so far are skipped.
+      * \returns true if \a hit has been updated, its shape being then set
+      */
+    bool intersect(const Ray& ray, Hit& hit) const;
+
+    /** \returns true if \a ray intersects a shape within its interval, stopping at the first one found
+      * (see Shape::occluded())
+      */
+    bool occluded(const Ray& ray) const;
+
+    /// \returns the number of shapes in the hierarchy, the unbounded ones excepted
+    int nbBoundedShapes() const { return int(m_shapes.size()); }
+
+    /// \returns the number of unbounded shapes, which are tested by every ray
+    int nbUnboundedShapes() const { return int(m_unboundedShapes.size()); }
+
+    /// Return a human-readable summary of the hierarchy
+    std::string toString() const;
+
+protected:
+
+    /// Build the subtree of the shapes [start,end) of m_order in the node \a nodeId
+    void buildNode(int nodeId, int start, int end, int depth);
+
+    /// Move the spheres of the leaf \a node first, and store them in packets
+    void packSpheres(Node& node);
+
+    /// \returns the index of the nearest sphere of \a node hit by \a ray closer than \a t, which is then updated, or -1
+    int intersectSpheres(const Node& node, const Ray& ray, float& t) const
+    {
+        int index = intersectSpherePackets(&m_packets[node.firstPacket], nbPackets(node.nbSpheres), ray, t);
+        return index < 0 ? -1 : node.first + index;
+    }
+
+    static int nbPackets(int nbSpheres) { return (nbSpheres + SpherePacket::Width - 1) / SpherePacket::Width; }
+
+    std::vector<Node> m_nodes;
+    std::vector<const Shape*> m_shapes;          // bounded shapes, in leaf order
+    std::vector<const Shape*> m_unboundedShapes;
+    std::vector<SpherePacket> m_packets;         // spheres of the leaves
+    // data used during the construction only
+    std::vector<Eigen::AlignedBox3f> m_boxes;    // boxes of the bounded shapes
+    std::vector<Point3f> m_centroids;
+    std::vector<bool> m_isSphere;
+    std::vector<int> m_order;                    // indices of the bounded shapes, in leaf order
+};
+
+#endif // SCENEBVH_H
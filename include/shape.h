@@ -6,6 +6,8 @@
 #include "material.h"
 #include "object.h"
 
+#include <Eigen/Geometry>
+
 /** represents a shape (geometry and material)
  */
 class Shape : public Object
@@ -15,11 +17,25 @@ public:
 
     Shape(const PropertyList&) {}
 
-    /** Search the nearest intersection between the ray and the shape.
-      * It must be implemented in the derived class. */
+    /** Search the nearest intersection between the ray and the shape within the interval of the ray,
+      * only updating \a hit if it is closer. It must be implemented in the derived class. */
     virtual bool intersect(const Ray& ray, Hit& hit) const {
         throw RTException("Shape::intersect must be implemented in the derived class"); }
 
+    /** \returns true if the ray intersects the shape within its interval (e.g. between a point and a light),
+      * without searching for the nearest intersection. By default, it is given by intersect(). */
+    virtual bool occluded(const Ray& ray) const;
+
+    /** Compute the normal and the texture coordinates of \a hit, the nearest intersection found
+      * by intersect(), from its distance, primitive and barycentric coordinates.
+      * It is only called once per ray, on the nearest shape. */
+    virtual void computeSurfaceInteraction(const Ray& ray, Hit& hit) const {
+        throw RTException("Shape::computeSurfaceInteraction must be implemented in the derived class"); }
+
+    /** \returns the bounding box of the shape, from which the scene builds its hierarchy of shapes.
+      * By default, it is infinite: the shape is unbounded (e.g. a plane) and tested by every ray. */
+    virtual const Eigen::AlignedBox3f& AABB() const;
+
     virtual const Material* material() const { return m_material; }
     virtual void setMaterial(const Material* mat) { m_material = mat; }
 
@@ -3,6 +3,7 @@
 #define SPHERE_H
 
 #include "shape.h"
+#include "spherepacket.h"
 
 #include <Eigen/Core>
 
@@ -17,6 +18,11 @@ public:
     virtual ~Sphere();
 
     virtual bool intersect(const Ray& ray, Hit& hit) const;
+    virtual void computeSurfaceInteraction(const Ray& ray, Hit& hit) const;
+    virtual const Eigen::AlignedBox3f& AABB() const { return m_AABB; }
+
+    const Point3f& center() const { return m_center; }
+    float radius() const { return m_radius; }
 
     /// Return a human-readable summary
     std::string toString() const {
@@ -33,6 +39,9 @@ public:
 protected:
     Point3f m_center;
     float   m_radius;
+    Eigen::AlignedBox3f m_AABB;
+    /// The sphere alone in a packet, so that it is tested by the same kernel as the spheres of the scene BVH
+    SpherePacket m_packet;
 };
 
 #endif
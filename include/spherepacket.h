@@ -0,0 +1,39 @@
+#ifndef SPHEREPACKET_H
+#define SPHEREPACKET_H
+
+class Ray;
+
+/** Group of spheres stored in SoA layout, as their centers and squared radii, so that they are
+  * tested together against a ray by the SIMD lanes of intersectSpherePackets().
+  * Unused lanes hold spheres of negative squared radius, which are never intersected.
+  */
+struct SpherePacket
+{
+    static constexpr int Width = 8;
+
+    alignas(32) float center[3][Width];
+    alignas(32) float radius2[Width];
+
+    /// Store the sphere of center \a c (3 coordinates) and radius \a radius in the lane \a lane
+    void set(int lane, const float* c, float radius) {
+        for (int k = 0; k < 3; ++k)
+            center[k][lane] = c[k];
+        radius2[lane] = radius * radius;
+    }
+
+    /// Store an empty sphere in the lane \a lane
+    void clear(int lane) {
+        for (int k = 0; k < 3; ++k)
+            center[k][lane] = 0.f;
+        radius2[lane] = -1.f;
+    }
+};
+
+/** Single precision test between \a ray, whose direction must be normalized, and the spheres of the \a count
+  * packets \a packets. Only the intersections farther than ray.tMin and closer than \a t are considered;
+  * \a t is then updated to the nearest one.
+  * \returns the index (packet * SpherePacket::Width + lane) of the nearest sphere hit, or -1
+  */
+int intersectSpherePackets(const SpherePacket* packets, int count, const Ray& ray, float& t);
+
+#endif // SPHEREPACKET_H
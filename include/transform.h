@@ -82,7 +82,7 @@ public:
     /// Apply the homogeneous transformation to a ray
     Ray operator*(const Ray &r) const {
         return Ray(operator*(r.origin),
-                   operator*(r.direction));
+                   operator*(r.direction), r.tMin, r.tMax);
     }
 
     /// Return a string representation
@@ -0,0 +1,41 @@
+#ifndef TRIANGLEPACKET_H
+#define TRIANGLEPACKET_H
+
+class Ray;
+
+/** Group of triangles stored in SoA layout, as a vertex and two edges, so that they are
+  * tested together against a ray by the SIMD lanes of intersectTrianglePackets().
+  * Unused lanes hold degenerate triangles, which are never intersected.
+  */
+struct TrianglePacket
+{
+    static constexpr int Width = 4;
+
+    alignas(16) float p0[3][Width];
+    alignas(16) float edge1[3][Width]; // p1 - p0
+    alignas(16) float edge2[3][Width]; // p2 - p0
+
+    /// Store the triangle of vertices \a v0, \a v1, \a v2 (3 coordinates each) in the lane \a lane
+    void set(int lane, const float* v0, const float* v1, const float* v2) {
+        for (int k = 0; k < 3; ++k) {
+            p0[k][lane] = v0[k];
+            edge1[k][lane] = v1[k] - v0[k];
+            edge2[k][lane] = v2[k] - v0[k];
+        }
+    }
+
+    /// Store a degenerate triangle in the lane \a lane
+    void clear(int lane) {
+        for (int k = 0; k < 3; ++k)
+            p0[k][lane] = edge1[k][lane] = edge2[k][lane] = 0.f;
+    }
+};
+
+/** Single precision Möller-Trumbore test between \a ray and the triangles of the \a count packets \a packets.
+  * Only the intersections farther than ray.tMin and closer than \a t are considered; \a t is then updated, along with the barycentric
+  * coordinates \a u and \a v of the nearest one.
+  * \returns the index (packet * TrianglePacket::Width + lane) of the nearest triangle hit, or -1
+  */
+int intersectTrianglePackets(const TrianglePacket* packets, int count, const Ray& ray, float& t, float& u, float& v);
+
+#endif // TRIANGLEPACKET_H
@@ -6,6 +6,8 @@
 
 #include <nanogui/screen.h>
 #include <nanogui/glutil.h>
+#include <atomic>
+#include <thread>
 
 class Viewer : public nanogui::Screen
 {
@@ -14,7 +16,10 @@ class Viewer : public nanogui::Screen
 
     ImageBlock* m_resultImage = nullptr;
     std::string m_curentFilename;
-    bool m_renderingDone;
+    std::atomic<bool> m_renderingDone;
+    int m_threadCount;
+    std::thread m_renderThread;
+    std::atomic<bool> m_stopRendering;
 
     // GUI
     nanogui::GLFramebuffer m_fbo;
@@ -43,6 +48,12 @@ class Viewer : public nanogui::Screen
     /** This method is called when files are dropped on the window */
     virtual bool dropEvent(const std::vector<std::string> &filenames);
 
+    /** Start the raytracing of the current scene in a background thread */
+    void startRendering(bool progressive);
+
+    /** Stop the raytracing in progress (if any) and wait for its thread */
+    void stopRendering();
+
   public: 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
     
@@ -52,6 +63,9 @@ class Viewer : public nanogui::Screen
     /** This method load an OpenEXR image from a file */
     void loadImage(const std::string &filename);
 
+    /** Set the number of threads used for raytracing (0 means one per core) */
+    void setThreadCount(int nbThreads) { m_threadCount = nbThreads; }
+
     // default constructor
     Viewer();
     ~Viewer();
@@ -17,6 +17,7 @@
 */
 
 #include <bitmap.h>
+#include <kernels.h>
 
 #define TINYEXR_IMPLEMENTATION
 #include <tinyexr.h>
@@ -160,11 +161,11 @@ void Bitmap::loadPNG(const std::string &filename) {
     }
 }
 
-void Bitmap::save(const filesystem::path &filename, bool flip) {
+void Bitmap::save(const filesystem::path &filename, bool flip, bool srgb) {
     if(filename.extension() == "exr")
         saveEXR(filename.str());
     else if(filename.extension() == "png")
-        savePNG(filename.str(), flip);
+        savePNG(filename.str(), flip, srgb);
     else
         cout << "Unknown file type" << endl;
     return;
@@ -231,19 +232,22 @@ void Bitmap::saveEXR(const std::string &filename) {
     free(header.requested_pixel_types);
 }
 
-void Bitmap::savePNG(const std::string &filename, bool flip) {
+void Bitmap::savePNG(const std::string &filename, bool flip, bool srgb) {
     cout << "Writing a " << cols() << "x" << rows() << " PNG file to \"" << filename << "\"" << endl;
 
-    std::vector<unsigned char> image;
+    // quantize the rows in the order in which they are written, then add the opaque alpha channel
+    std::vector<unsigned char> image, row(cols() * 3);
     image.resize(cols() * rows() * 4);
-    for (unsigned i = 0; i < cols(); ++i)
-        for (unsigned j = 0; j < rows(); ++j) {
-            unsigned y = flip ? rows() - 1 - j : j;
-            image[4 * (i + j * cols()) + 0] = static_cast<unsigned char>((*this)(y,i).r() * 255);
-            image[4 * (i + j * cols()) + 1] = static_cast<unsigned char>((*this)(y,i).g() * 255);
-            image[4 * (i + j * cols()) + 2] = static_cast<unsigned char>((*this)(y,i).b() * 255);
+    for (unsigned j = 0; j < rows(); ++j) {
+        unsigned y = flip ? rows() - 1 - j : j;
+        kernels().tonemap(reinterpret_cast<const float *>(&coeff(y, 0)), 3 * cols(), row.data(), srgb);
+        for (unsigned i = 0; i < cols(); ++i) {
+            image[4 * (i + j * cols()) + 0] = row[3 * i + 0];
+            image[4 * (i + j * cols()) + 1] = row[3 * i + 1];
+            image[4 * (i + j * cols()) + 2] = row[3 * i + 2];
             image[4 * (i + j * cols()) + 3] = 255;
         }
+    }
 
     unsigned error = lodepng::encode(filename, image, cols(), rows());
 
@@ -53,12 +53,10 @@ void ImageBlock::put(const Vector2f &_pos, const Color3f &value) {
     }
 
     /* Convert to pixel coordinates within the image block */
-    Point2i pos(_pos.x() - (m_offset.x() - m_borderSize),
-                _pos.y() - (m_offset.y() - m_borderSize));
+    Point2i pos((int) std::floor(_pos.x()) - (m_offset.x() - m_borderSize),
+                (int) std::floor(_pos.y()) - (m_offset.y() - m_borderSize));
 
-    for (int y=(int)std::floor(pos.y()); y<=(int)std::ceil(pos.y()); ++y)
-        for (int x=(int)std::floor(pos.x()); x<=(int)std::ceil(pos.x()); ++x)
-            coeffRef(y, x) += Color4f(value);
+    coeffRef(pos.y(), pos.x()) += Color4f(value);
 }
 
 void ImageBlock::put(ImageBlock &b) {
@@ -90,14 +88,25 @@ BlockGenerator::BlockGenerator(const Vector2i  &size, int blockSize)
 }
 
 bool BlockGenerator::next(ImageBlock &block) {
+    Point2i offset;
+    Vector2i size;
+    if (!next(offset, size))
+        return false;
+
+    block.setOffset(offset);
+    block.setSize(size);
+    return true;
+}
+
+bool BlockGenerator::next(Point2i &offset, Vector2i &size) {
     ScopedLock lck(m_mutex);
 
     if (m_blocksLeft == 0)
         return false;
 
     Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i ::Constant(m_blockSize)));
+    offset = pos;
+    size = (m_size - pos).cwiseMin(Vector2i ::Constant(m_blockSize));
 
     if (--m_blocksLeft == 0)
         return true;
@@ -122,3 +131,124 @@ bool BlockGenerator::next(ImageBlock &block) {
     return true;
 }
 
+
+BlockScheduler::BlockScheduler(const Vector2i &size, int blockSize, int workerCount)
+    : m_workers(std::max(workerCount, 1)) {
+    /* Retrieve all the blocks in spiral order */
+    BlockGenerator generator(size, blockSize);
+    std::vector<Block> spiral(generator.getBlockCount());
+    for (Block &block : spiral)
+        generator.next(block.offset, block.size);
+
+    /* Deal them round-robin, so that the deque of each worker is contiguous
+       in m_blocks and still sorted in spiral order */
+    int nbWorkers = getWorkerCount();
+    m_blocks.reserve(spiral.size());
+    for (int w = 0; w < nbWorkers; ++w) {
+        uint32_t first = (uint32_t) m_blocks.size();
+        for (size_t i = w; i < spiral.size(); i += nbWorkers)
+            m_blocks.push_back(spiral[i]);
+        m_workers[w].range = pack(first, (uint32_t) m_blocks.size());
+    }
+
+    m_startTime = Clock::now();
+    for (Worker &worker : m_workers)
+        worker.lastTime = worker.endTime = m_startTime;
+}
+
+int BlockScheduler::popFront(Worker &worker) {
+    uint64_t range = worker.range.load(std::memory_order_relaxed);
+    while (head(range) < tail(range)) {
+        if (worker.range.compare_exchange_weak(range, pack(head(range) + 1, tail(range)),
+                                               std::memory_order_relaxed))
+            return head(range);
+    }
+    return -1;
+}
+
+int BlockScheduler::popBack(Worker &worker) {
+    uint64_t range = worker.range.load(std::memory_order_relaxed);
+    while (head(range) < tail(range)) {
+        if (worker.range.compare_exchange_weak(range, pack(head(range), tail(range) - 1),
+                                               std::memory_order_relaxed))
+            return tail(range) - 1;
+    }
+    return -1;
+}
+
+bool BlockScheduler::next(int workerId, ImageBlock &block) {
+    Worker &self = m_workers[workerId];
+    Clock::time_point now = Clock::now();
+    if (self.busy)
+        self.stats.busyTime += std::chrono::duration<double, std::milli>(now - self.lastTime).count();
+
+    int index = popFront(self);
+    bool stolen = false;
+    while (index < 0) {
+        /* Our deque is empty: steal from the worker with the most remaining blocks */
+        Worker *victim = nullptr;
+        uint32_t victimLeft = 0;
+        for (int i = 1; i < getWorkerCount(); ++i) {
+            Worker &other = m_workers[(workerId + i) % getWorkerCount()];
+            uint64_t range = other.range.load(std::memory_order_relaxed);
+            uint32_t left = head(range) < tail(range) ? tail(range) - head(range) : 0;
+            if (left > victimLeft) {
+                victim = &other;
+                victimLeft = left;
+            }
+        }
+        if (!victim)
+            break;
+        index = popBack(*victim);
+        stolen = true;
+    }
+
+    self.lastTime = Clock::now();
+    if (index < 0) {
+        self.busy = false;
+        self.endTime = self.lastTime;
+        return false;
+    }
+
+    self.busy = true;
+    ++self.stats.blockCount;
+    if (stolen)
+        ++self.stats.stolenCount;
+    block.setOffset(m_blocks[index].offset);
+    block.setSize(m_blocks[index].size);
+    return true;
+}
+
+std::vector<BlockScheduler::WorkerStats> BlockScheduler::getStatistics() const {
+    /* The frame ends when the last worker runs out of blocks */
+    Clock::time_point frameEnd = m_startTime;
+    for (const Worker &worker : m_workers)
+        frameEnd = std::max(frameEnd, worker.endTime);
+    double frameTime = std::chrono::duration<double, std::milli>(frameEnd - m_startTime).count();
+
+    std::vector<WorkerStats> result;
+    for (const Worker &worker : m_workers) {
+        WorkerStats stats = worker.stats;
+        stats.idleTime = std::max(0.0, frameTime - stats.busyTime);
+        result.push_back(stats);
+    }
+    return result;
+}
+
+std::string BlockScheduler::toString() const {
+    std::string workers;
+    std::vector<WorkerStats> stats = getStatistics();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        workers += tfm::format("  worker %i: blocks = %i (%i stolen), busy = %s, idle = %s",
+                               i, stats[i].blockCount, stats[i].stolenCount,
+                               timeString(stats[i].busyTime, true),
+                               timeString(stats[i].idleTime, true));
+        if (i + 1 < stats.size())
+            workers += ",";
+        workers += "\n";
+    }
+    return tfm::format("BlockScheduler[\n"
+                       "  blockCount = %i,\n"
+                       "%s"
+                       "]", getBlockCount(), workers);
+}
@@ -1,184 +1,1159 @@
 
 #include "bvh.h"
 #include "mesh.h"
+#include "kernels.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <random>
 
-void BVH::build(const Mesh* pMesh, int targetCellSize, int maxDepth)
+/* Relative costs of the traversal of an inner node and of a ray/triangle test used by the SAH */
+static const float TraversalCost = 1.f;
+static const float IntersectionCost = 1.f;
+/* Number of bins per axis of the binned SAH */
+static const int SAHBinCount = 16;
+/* Size of the stack of the traversal, which bounds the depth of the tree */
+static const int TraversalStackSize = 64;
+/* Minimal number of faces per thread for the parallel loops of the construction */
+static const int ParallelGrainSize = 16384;
+/* Minimal number of faces of a node whose two subtrees are built concurrently */
+static const int ParallelSubtreeSize = 4096;
+/* Version of the files of the BVH cache, to be incremented whenever the tree or its layout change */
+static const int CacheFormatVersion = 3;
+
+thread_local long int BVH::ms_node_count = 0;
+
+/* The faces of a leaf are tested by packets, each costing about as much as a single ray/triangle test */
+static float intersectionCost(int nbFaces)
+{
+    return IntersectionCost * ((nbFaces + TrianglePacket::Width - 1) / TrianglePacket::Width);
+}
+
+static float surfaceArea(const Eigen::AlignedBox3f& box)
+{
+    if (box.isEmpty())
+        return 0.f;
+    Vector3f d = box.diagonal();
+    return 2.f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+void BVH::build(const Mesh* pMesh, int targetCellSize, int maxDepth, SplitMethod method, int width, bool compressed)
 {
+    auto start = std::chrono::steady_clock::now();
+
     // store a pointer to the mesh
     m_pMesh = pMesh;
+    m_method = method;
+
+    // reuse the tree saved by a previous construction of the same faces with the same parameters
+    std::string cacheFile;
+    uint64_t key = 0;
+    if (!getCacheDirectory().empty()) {
+        key = cacheKey(targetCellSize, maxDepth, method, width, compressed);
+        cacheFile = (filesystem::path(getCacheDirectory()) / filesystem::path(tfm::format("%016x.bvh", key))).str();
+        if (load(cacheFile, key)) {
+            buildPackets();
+            m_fromCache = true;
+            m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return;
+        }
+    }
+    // the traversal stack holds at most one node per level
+    maxDepth = std::min(maxDepth, TraversalStackSize);
+    int nbFaces = m_pMesh->nbFaces();
     // allocate the root node
     m_nodes.resize(1);
+    m_faces.resize(nbFaces);
 
-    if(m_pMesh->nbFaces() <= targetCellSize) { // only one node
+    if(nbFaces <= targetCellSize) { // only one node
         m_nodes[0].box = pMesh->AABB();
         m_nodes[0].first_face_id = 0;
         m_nodes[0].is_leaf = true;
-        m_nodes[0].nb_faces = m_pMesh->nbFaces();
-        m_faces.resize(m_pMesh->nbFaces());
-        for(int i=0; i<m_pMesh->nbFaces(); ++i)
+        m_nodes[0].nb_faces = nbFaces;
+        for(int i=0; i<nbFaces; ++i)
         {
             m_faces[i] = i;
         }
     }else{
-        // reserve space for other nodes to avoid multiple memory reallocations
-        m_nodes.reserve( std::min<int>(2<<maxDepth, std::log(m_pMesh->nbFaces()/targetCellSize) ) );
+        // preallocate the nodes of the tree: a binary tree with at most one face per leaf has at most 2N-1 nodes,
+        // so that the nodes can be allocated concurrently by incrementing a counter
+        m_nodes.resize(2 * nbFaces - 1);
+        m_nodeCount = 1;
+        m_buildThreads = 1;
 
-        // compute centroids and initialize the face list
-        m_centroids.resize(m_pMesh->nbFaces());
-        m_faces.resize(m_pMesh->nbFaces());
-        for(int i=0; i<m_pMesh->nbFaces(); ++i)
-        {
-            m_centroids[i] = (m_pMesh->vertexOfFace(i, 0).position + m_pMesh->vertexOfFace(i, 1).position + m_pMesh->vertexOfFace(i, 2).position)/3.f;
-            m_faces[i] = i;
-        }
+        // compute the bounding boxes and centroids of the faces, and initialize the face list
+        m_centroids.resize(nbFaces);
+        m_faceBoxes.resize(nbFaces);
+        m_scratch.resize(nbFaces);
+        parallelChunks(0, nbFaces, getChunkCount(nbFaces, ParallelGrainSize), [&](int, int first, int last) {
+            for(int i=first; i<last; ++i)
+            {
+                m_faceBoxes[i].setEmpty();
+                for(int k=0; k<3; ++k)
+                    m_faceBoxes[i].extend(m_pMesh->vertexOfFace(i, k).position);
+                m_centroids[i] = (m_pMesh->vertexOfFace(i, 0).position + m_pMesh->vertexOfFace(i, 1).position + m_pMesh->vertexOfFace(i, 2).position)/3.f;
+                m_faces[i] = i;
+            }
+        });
 
         // recursively build the BVH, starting from the root node and the entire list of faces
-        buildNode(0, 0, m_pMesh->nbFaces(), 0, targetCellSize, maxDepth);
+        buildNode(0, 0, nbFaces, 0, targetCellSize, maxDepth);
+
+        // release the unused nodes, and the per face data which are not needed anymore
+        m_nodes.resize(m_nodeCount);
+        m_nodes.shrink_to_fit();
+        m_centroids = std::vector<Point3f>();
+        m_faceBoxes = std::vector<Eigen::AlignedBox3f>();
+        m_scratch = std::vector<int>();
+    }
+    alignLeaves();
+
+    m_box = m_nodes[0].box;
+    m_statistics = computeStatistics();
+    buildPackets();
+    m_binaryMemoryUsage = getMemoryUsage();
+
+    // collapse the binary tree into a wide one, which replaces it, and possibly compress it
+    m_width = width;
+    m_compressed = compressed && (width == 4 || width == 8);
+    if (m_compressed && (m_statistics.maxLeafSize > 32 || m_faces.size() >= (1u << 26))) {
+        std::cerr << "BVH: leaves too large to be compressed, the tree is kept uncompressed" << std::endl;
+        m_compressed = false;
     }
+    if (width == 4)
+        collapse(m_wideNodes4, 0);
+    else if (width == 8)
+        collapse(m_wideNodes8, 0);
+    else
+        m_width = 2;
+    if (m_width != 2)
+        m_nodes = NodeList();
+    if (m_compressed) {
+        quantize(m_wideNodes4, m_quantizedNodes4);
+        quantize(m_wideNodes8, m_quantizedNodes8);
+        m_wideNodes4 = std::vector<WideNode<4>>();
+        m_wideNodes8 = std::vector<WideNode<8>>();
+    }
+
+    m_buildTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (!cacheFile.empty())
+        save(cacheFile, key);
 }
 
-bool BVH::intersect(const Ray& ray, Hit& hit) const
+static std::string& cacheDirectory()
+{
+    static std::string directory = getenv("MDS3D_BVH_CACHE") ? getenv("MDS3D_BVH_CACHE") : "";
+    return directory;
+}
+
+void BVH::setCacheDirectory(const std::string& directory)
+{
+    cacheDirectory() = directory;
+}
+
+const std::string& BVH::getCacheDirectory()
+{
+    return cacheDirectory();
+}
+
+namespace {
+
+/// Header of the files of the BVH cache, followed by the arrays of the tree
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t key;
+    int32_t width;
+    int32_t compressed;
+    int32_t method;
+    /// number of elements of the binary, 4-wide, 8-wide, quantized 4-wide and 8-wide node arrays, and of the face array
+    uint64_t sizes[6];
+    float box[6];
+    BVH::Statistics statistics;
+    uint64_t binaryMemoryUsage;
+};
+
+const char CacheMagic[8] = { 'M', 'D', 'S', '3', 'D', 'B', 'V', 'H' };
+
+template <typename T>
+void readArray(const char*& data, size_t size, std::vector<T>& array)
+{
+    array.resize(size);
+    memcpy((void*) array.data(), data, size * sizeof(T));
+    data += size * sizeof(T);
+}
+
+template <typename T>
+void writeArray(std::ofstream& os, const std::vector<T>& array)
+{
+    os.write((const char*) array.data(), array.size() * sizeof(T));
+}
+
+} // namespace
+
+uint64_t BVH::cacheKey(int targetCellSize, int maxDepth, SplitMethod method, int width, bool compressed) const
 {
-    // compute the intersection with the root node
-    float tMin, tMax;
-    Normal3f n;
-    if (::intersect(ray, m_nodes[0].box, tMin, tMax, n))
-        return intersectNode(0, ray, hit);
-    
-    return false;
-
-    // TODO
-    // vérifier si on a bien une intersection (en fonction de tMin, tMax, et hit.t()), et si oui appeler intersecNode...en fonction de tMin, tMax, et hit.t()
-}
-
-bool BVH::intersectNode(int nodeId, const Ray& ray, Hit& hit) const
-{
-    const Node& node = m_nodes[nodeId];
-    // std::cout << "min : " << node.box.min() << " max : " << node.box.max() << std::endl;
-    // TODO, deux cas: soit mNodes[nodeId] est une feuille (il faut alors intersecter les triangles du noeud),
-    // soit c'est un noeud interne (il faut visiter les fils (ou pas))
-    bool has_intersect = false;
-    auto setIntersect = [&] (auto&& f) {
-        Hit tmp_hit;
-        if (f(tmp_hit)) {
-            has_intersect = true;
-            if (tmp_hit.t() < hit.t()) {
-                hit.setT(tmp_hit.t());
-                hit.setNormal(tmp_hit.normal());
+    // the tree only depends on the positions of the vertices of the faces, which are hashed
+    // in parallel by blocks of fixed size, so that the key does not depend on the number of cores
+    const int BlockSize = 4096;
+    int nbFaces = m_pMesh->nbFaces();
+    int blockCount = (nbFaces + BlockSize - 1) / BlockSize;
+    std::vector<uint64_t> hashes(blockCount + 1);
+    parallelChunks(0, blockCount, getChunkCount(nbFaces, ParallelGrainSize), [&](int, int firstBlock, int lastBlock) {
+        for (int block = firstBlock; block < lastBlock; ++block) {
+            uint64_t h = 0;
+            for (int i = block * BlockSize; i < std::min(nbFaces, (block + 1) * BlockSize); ++i) {
+                float positions[9];
+                for (int k = 0; k < 3; ++k)
+                    for (int j = 0; j < 3; ++j)
+                        positions[3 * k + j] = m_pMesh->vertexOfFace(i, k).position[j];
+                h = hashBytes(positions, sizeof(positions), h);
             }
+            hashes[block] = h;
+        }
+    });
+
+    int parameters[] = { CacheFormatVersion, nbFaces, targetCellSize, std::min(maxDepth, TraversalStackSize),
+                         int(method), width, int(compressed), int(sizeof(Node)), int(sizeof(WideNode<8>)),
+                         int(sizeof(QuantizedNode<8>)) };
+    hashes[blockCount] = hashBytes(parameters, sizeof(parameters));
+    return hashBytes(hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+bool BVH::load(const std::string& filename, uint64_t key)
+{
+    if (!filesystem::path(filename).is_file())
+        return false;
+    try {
+        MappedFile file(filename);
+        CacheHeader header;
+        if (file.size() < sizeof(header))
+            return false;
+        memcpy(&header, file.data(), sizeof(header));
+        // bound the sizes first, so that the total size below cannot wrap around
+        for (int i = 0; i < 6; ++i)
+            if (header.sizes[i] > file.size())
+                return false;
+        size_t size = sizeof(header) + header.sizes[0] * sizeof(Node) + header.sizes[1] * sizeof(WideNode<4>)
+                    + header.sizes[2] * sizeof(WideNode<8>) + header.sizes[3] * sizeof(QuantizedNode<4>)
+                    + header.sizes[4] * sizeof(QuantizedNode<8>) + header.sizes[5] * sizeof(int);
+        if (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0 || header.key != key || file.size() != size
+                || header.sizes[5] < size_t(m_pMesh->nbFaces()) || header.sizes[5] % TrianglePacket::Width != 0)
+            return false;
+
+        const char* data = file.data() + sizeof(header);
+        readArray(data, header.sizes[0], m_nodes);
+        readArray(data, header.sizes[1], m_wideNodes4);
+        readArray(data, header.sizes[2], m_wideNodes8);
+        readArray(data, header.sizes[3], m_quantizedNodes4);
+        readArray(data, header.sizes[4], m_quantizedNodes8);
+        readArray(data, header.sizes[5], m_faces);
+        m_width = header.width;
+        m_compressed = header.compressed != 0;
+        m_method = SplitMethod(header.method);
+        m_box = Eigen::AlignedBox3f(Vector3f(header.box[0], header.box[1], header.box[2]),
+                                    Vector3f(header.box[3], header.box[4], header.box[5]));
+        m_statistics = header.statistics;
+        m_binaryMemoryUsage = header.binaryMemoryUsage;
+        if (!isValid()) {
+            std::cerr << "BVH: \"" << filename << "\" is corrupt, the tree is rebuilt" << std::endl;
+            m_nodes.clear();
+            m_wideNodes4.clear();
+            m_wideNodes8.clear();
+            m_quantizedNodes4.clear();
+            m_quantizedNodes8.clear();
+            m_faces.clear();
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "BVH: unable to load \"" << filename << "\" from the cache: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+namespace {
+
+/// \returns true if the leaf of faces [first, first+count) starts on a packet and lies within the \a faceCount faces
+bool isValidLeaf(int first, int count, size_t faceCount)
+{
+    return first >= 0 && count >= 0 && first % TrianglePacket::Width == 0 && size_t(first) + size_t(count) <= faceCount;
+}
+
+/** \returns true if the children of \a wideNodes follow their parent within the array, their leaves lie within the
+  * \a faceCount faces, and the depth of the tree fits in the traversal stack */
+template <typename WideNodeType>
+bool isValidWideTree(const std::vector<WideNodeType>& wideNodes, size_t faceCount)
+{
+    std::vector<int> levels(wideNodes.size(), 0);
+    for (size_t n = 0; n < wideNodes.size(); ++n) {
+        if (levels[n] >= TraversalStackSize)
+            return false;
+        for (int i = 0; i < WideNodeType::ChildCount; ++i) {
+            int first = 0, count = 0;
+            int child = wideNodes[n].child(i, first, count);
+            if (child >= 0) {
+                if (size_t(child) <= n || size_t(child) >= wideNodes.size())
+                    return false;
+                levels[child] = std::max(levels[child], levels[n] + 1);
+            } else if (!isValidLeaf(first, count, faceCount))
+                return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool BVH::isValid() const
+{
+    int nbFaces = m_pMesh->nbFaces();
+    for (int faceId : m_faces)
+        if (faceId < -1 || faceId >= nbFaces)
+            return false;
+
+    // the children are allocated after their parent, which bounds the traversals
+    std::vector<int> levels(m_nodes.size(), 0);
+    for (size_t n = 0; n < m_nodes.size(); ++n) {
+        const Node& node = m_nodes[n];
+        if (node.is_leaf) {
+            if (levels[n] > TraversalStackSize || !isValidLeaf(node.first_face_id, node.nb_faces, m_faces.size()))
+                return false;
+            continue;
+        }
+        int child = node.first_child_id;
+        if (levels[n] >= TraversalStackSize || child <= int(n) || size_t(child) + 1 >= m_nodes.size())
+            return false;
+        levels[child] = std::max(levels[child], levels[n] + 1);
+        levels[child + 1] = std::max(levels[child + 1], levels[n] + 1);
+    }
+
+    return isValidWideTree(m_wideNodes4, m_faces.size()) && isValidWideTree(m_wideNodes8, m_faces.size())
+           && isValidWideTree(m_quantizedNodes4, m_faces.size()) && isValidWideTree(m_quantizedNodes8, m_faces.size());
+}
+
+void BVH::save(const std::string& filename, uint64_t key) const
+{
+    filesystem::path directory = filesystem::path(filename).parent_path();
+    if (!directory.empty() && !directory.exists())
+        filesystem::create_directory(directory);
+
+    CacheHeader header{};
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.key = key;
+    header.width = m_width;
+    header.compressed = m_compressed;
+    header.method = m_method;
+    size_t sizes[6] = { m_nodes.size(), m_wideNodes4.size(), m_wideNodes8.size(), m_quantizedNodes4.size(),
+                        m_quantizedNodes8.size(), m_faces.size() };
+    for (int i = 0; i < 6; ++i)
+        header.sizes[i] = sizes[i];
+    for (int k = 0; k < 3; ++k) {
+        header.box[k] = m_box.min()[k];
+        header.box[3 + k] = m_box.max()[k];
+    }
+    header.statistics = m_statistics;
+    header.binaryMemoryUsage = m_binaryMemoryUsage;
+
+    // write a temporary file first, so that a concurrent session never loads a partial tree, under a unique name,
+    // so that the sessions building the same tree at once do not write the same file
+    std::random_device random;
+    uint64_t suffix = (uint64_t(random()) << 32) ^ random()
+                      ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string tmpFilename = tfm::format("%s.%016x.tmp", filename, suffix);
+    {
+        std::ofstream os(tmpFilename, std::ios::binary);
+        os.write((const char*) &header, sizeof(header));
+        writeArray(os, m_nodes);
+        writeArray(os, m_wideNodes4);
+        writeArray(os, m_wideNodes8);
+        writeArray(os, m_quantizedNodes4);
+        writeArray(os, m_quantizedNodes8);
+        writeArray(os, m_faces);
+        if (!os) {
+            std::cerr << "BVH: unable to write \"" << tmpFilename << "\" in the cache" << std::endl;
+            std::remove(tmpFilename.c_str());
+            return;
         }
+    }
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        // rename() does not replace an existing file on every platform
+        std::remove(filename.c_str());
+        if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+            std::remove(tmpFilename.c_str());
+    }
+}
+
+namespace {
+
+/// Ray data precomputed once per traversal for the slab tests
+struct TraversalRay
+{
+    TraversalRay(const Ray& ray)
+        : origin(ray.origin), invDirection(ray.direction.cwiseInverse())
+    {
+        for (int k = 0; k < 3; ++k)
+            sign[k] = invDirection[k] < 0.f;
+    }
+
+    Point3f origin;
+    Vector3f invDirection;
+    int sign[3];
+};
+
+/** Slab test between \a ray and \a box, which does not compute the normal of the box.
+  * \returns true if the ray enters the box before \a tMax, the entry distance being returned in \a tNear
+  */
+inline bool intersectBox(const Eigen::AlignedBox3f& box, const TraversalRay& ray, float tMax, float& tNear)
+{
+    const Eigen::Vector3f* bounds[2] = { &box.min(), &box.max() };
+    float tFar = tMax;
+    tNear = -std::numeric_limits<float>::max();
+    for (int k = 0; k < 3; ++k) {
+        float t0 = ((*bounds[ray.sign[k]])[k] - ray.origin[k]) * ray.invDirection[k];
+        float t1 = ((*bounds[1 - ray.sign[k]])[k] - ray.origin[k]) * ray.invDirection[k];
+        // written so that a NaN (ray within the plane of a slab) leaves the bounds unchanged
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tFar > 0.f && tNear <= tFar;
+}
+
+/// Slab test between \a ray and the 4 boxes stored in SoA layout in \a bounds, see Kernels::intersectBoxes4
+inline int intersectBoxes(const float (&bounds)[6][4], const TraversalRay& ray, float tMax, float* tNear)
+{
+    return kernels().intersectBoxes4(bounds, ray.origin.data(), ray.invDirection.data(), ray.sign, tMax, tNear);
+}
+
+/// Slab test between \a ray and the 8 boxes stored in SoA layout in \a bounds, see Kernels::intersectBoxes8
+inline int intersectBoxes(const float (&bounds)[6][8], const TraversalRay& ray, float tMax, float* tNear)
+{
+    return kernels().intersectBoxes8(bounds, ray.origin.data(), ray.invDirection.data(), ray.sign, tMax, tNear);
+}
+
+/// Slab test between \a ray and 4 boxes quantized as in BVH::QuantizedNode, see Kernels::intersectQuantizedBoxes4
+inline int intersectBoxes(const uint8_t (&bounds)[6][4], const float* boxOrigin, const float* scale, const TraversalRay& ray,
+                          float tMax, float* tNear)
+{
+    return kernels().intersectQuantizedBoxes4(bounds, boxOrigin, scale, ray.origin.data(), ray.invDirection.data(), ray.sign,
+                                              tMax, tNear);
+}
+
+/// Slab test between \a ray and 8 boxes quantized as in BVH::QuantizedNode, see Kernels::intersectQuantizedBoxes8
+inline int intersectBoxes(const uint8_t (&bounds)[6][8], const float* boxOrigin, const float* scale, const TraversalRay& ray,
+                          float tMax, float* tNear)
+{
+    return kernels().intersectQuantizedBoxes8(bounds, boxOrigin, scale, ray.origin.data(), ray.invDirection.data(), ray.sign,
+                                              tMax, tNear);
+}
+
+/// Slab test between \a ray and the children of a wide node. \returns the bit mask of the intersected children
+template <typename WideNodeType>
+inline int intersectChildren(const WideNodeType& node, const TraversalRay& ray, float tMax, float* tNear)
+{
+    if constexpr (WideNodeType::Quantized)
+        return intersectBoxes(node.bounds, node.origin, node.scale, ray, tMax, tNear);
+    else
+        return intersectBoxes(node.bounds, ray, tMax, tNear);
+}
+
+} // namespace
+
+bool BVH::intersect(const Ray& ray, Hit& hit) const
+{
+    if (m_width == 4)
+        return m_compressed ? intersectWide(m_quantizedNodes4, ray, hit) : intersectWide(m_wideNodes4, ray, hit);
+    if (m_width == 8)
+        return m_compressed ? intersectWide(m_quantizedNodes8, ray, hit) : intersectWide(m_wideNodes8, ray, hit);
+
+    // end of the interval, tightened by each hit
+    float tMax = std::min(ray.tMax, hit.t());
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (m_nodes.empty() || !intersectBox(m_nodes[0].box, traversalRay, tMax, tNear))
+        return false;
+
+    // far children still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        int nodeId;
+        float tNear;
     };
-    float tMin, tMax;
-    Normal3f normal;
+    StackEntry stack[TraversalStackSize];
+    int stackSize = 0;
+
+    bool found = false;
+    TriangleHit triangleHit;
+    int nodeId = 0;
+    while (true) {
+        ++ms_node_count;
+        const Node& node = m_nodes[nodeId];
+        if (node.is_leaf) {
+            // the faces only update the hit if they are closer
+            found |= intersectTriangles(ray, node.first_face_id, node.nb_faces, tMax, triangleHit);
+        } else {
+            // the box of this node has been tested by its parent, test its children and visit the nearest first
+            int near = node.first_child_id, far = node.first_child_id + 1;
+            float tNear0, tNear1;
+            bool hit0 = intersectBox(m_nodes[near].box, traversalRay, tMax, tNear0);
+            bool hit1 = intersectBox(m_nodes[far].box, traversalRay, tMax, tNear1);
+            if (hit0 && hit1) {
+                if (tNear1 < tNear0) {
+                    std::swap(near, far);
+                    std::swap(tNear0, tNear1);
+                }
+                stack[stackSize++] = { far, tNear1 };
+                nodeId = near;
+                continue;
+            }
+            if (hit0 || hit1) {
+                nodeId = hit0 ? near : far;
+                continue;
+            }
+        }
+
+        // go on with the nearest pending node which is not behind the closest hit
+        while (stackSize > 0 && stack[stackSize - 1].tNear > tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        nodeId = stack[--stackSize].nodeId;
+    }
+    if (found) {
+        hit.setT(tMax);
+        hit.setPrimitive(m_faces[triangleHit.index], triangleHit.u, triangleHit.v);
+    }
+    return found;
+}
+
+bool BVH::occluded(const Ray& ray) const
+{
+    if (m_width == 4)
+        return m_compressed ? occludedWide(m_quantizedNodes4, ray) : occludedWide(m_wideNodes4, ray);
+    if (m_width == 8)
+        return m_compressed ? occludedWide(m_quantizedNodes8, ray) : occludedWide(m_wideNodes8, ray);
 
-    if (!::intersect(ray, node.box, tMin, tMax, normal))
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (m_nodes.empty() || !intersectBox(m_nodes[0].box, traversalRay, ray.tMax, tNear))
         return false;
 
-    if (node.is_leaf) {
-        for (int i = 0; i < node.nb_faces; ++i)
-            setIntersect([&] (auto& tmp_hit) {
-                return m_pMesh->intersectFace(ray, tmp_hit, m_faces[node.first_face_id + i]) && tmp_hit.t() > 0;
-            });
+    // any hit ends the traversal, so the children are neither sorted nor culled by distance
+    int stack[TraversalStackSize];
+    int stackSize = 0;
+
+    int nodeId = 0;
+    while (true) {
+        ++ms_node_count;
+        const Node& node = m_nodes[nodeId];
+        if (node.is_leaf) {
+            if (occludedTriangles(ray, node.first_face_id, node.nb_faces))
+                return true;
+        } else {
+            int first = node.first_child_id, second = node.first_child_id + 1;
+            bool hit0 = intersectBox(m_nodes[first].box, traversalRay, ray.tMax, tNear);
+            bool hit1 = intersectBox(m_nodes[second].box, traversalRay, ray.tMax, tNear);
+            if (hit0 && hit1)
+                stack[stackSize++] = second;
+            if (hit0 || hit1) {
+                nodeId = hit0 ? first : second;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            return false;
+        nodeId = stack[--stackSize];
     }
+}
+
+template <int Width>
+int BVH::collapse(std::vector<WideNode<Width>>& wideNodes, int nodeId) const
+{
+    // gather up to Width descendants of the node, opening the inner node with the largest box first
+    int children[Width];
+    int count = 0;
+    if (m_nodes[nodeId].is_leaf)
+        children[count++] = nodeId;
     else {
-        float tMin1, tMin2, tMax1, tMax2;
-        Normal3f normal1, normal2;
-        int index1 = node.first_child_id;
-        int index2 = node.first_child_id + 1;
-        bool has_intersect1 = ::intersect(ray, m_nodes[index1].box, tMin1, tMax1, normal1) && hit.t() >= tMin1;
-        bool has_intersect2 = ::intersect(ray, m_nodes[index2].box, tMin2, tMax2, normal2) && hit.t() >= tMin2;
+        children[count++] = m_nodes[nodeId].first_child_id;
+        children[count++] = m_nodes[nodeId].first_child_id + 1;
+    }
+    while (count < Width) {
+        int largest = -1;
+        float largestArea = -1.f;
+        for (int i = 0; i < count; ++i) {
+            const Node& child = m_nodes[children[i]];
+            if (!child.is_leaf && surfaceArea(child.box) > largestArea) {
+                largest = i;
+                largestArea = surfaceArea(child.box);
+            }
+        }
+        if (largest < 0)
+            break;
+        int first_child_id = m_nodes[children[largest]].first_child_id;
+        children[largest] = first_child_id;
+        children[count++] = first_child_id + 1;
+    }
+
+    // the leaves reference their first face, the inner children are collapsed below
+    int wideChildren[Width];
+    for (int i = 0; i < count; ++i) {
+        const Node& child = m_nodes[children[i]];
+        wideChildren[i] = child.is_leaf ? ~child.first_face_id : 0;
+    }
+    // the node is allocated before its children, so that it precedes them in the array, but only filled after
+    // they are collapsed: their allocations may reallocate the array, so it is accessed by index meanwhile
+    int wideId = (int) wideNodes.size();
+    wideNodes.emplace_back();
+    for (int i = 0; i < count; ++i)
+        if (!m_nodes[children[i]].is_leaf)
+            wideChildren[i] = collapse(wideNodes, children[i]);
+
+    WideNode<Width>& wideNode = wideNodes[wideId];
+    for (int i = 0; i < Width; ++i) {
+        // the empty slots have an inverted box, which is never intersected
+        Eigen::AlignedBox3f box;
+        if (i < count)
+            box = m_nodes[children[i]].box;
+        for (int k = 0; k < 3; ++k) {
+            wideNode.bounds[k][i] = box.min()[k];
+            wideNode.bounds[3 + k][i] = box.max()[k];
+        }
+        wideNode.children[i] = i < count ? wideChildren[i] : ~0;
+        wideNode.nb_faces[i] = i < count && m_nodes[children[i]].is_leaf ? m_nodes[children[i]].nb_faces : 0;
+    }
+    return wideId;
+}
+
+template <int Width>
+void BVH::quantize(const std::vector<WideNode<Width>>& wideNodes, std::vector<QuantizedNode<Width>>& quantizedNodes) const
+{
+    typedef QuantizedNode<Width> QNode;
+    quantizedNodes.resize(wideNodes.size());
+    for (size_t n = 0; n < wideNodes.size(); ++n) {
+        const WideNode<Width>& node = wideNodes[n];
+        QNode& quantizedNode = quantizedNodes[n];
+
+        // the frame of the quantization is the box of the children, with a margin of one step,
+        // so that the boxes can be rounded outwards without any rounding error
+        Eigen::AlignedBox3f box;
+        for (int i = 0; i < Width; ++i)
+            if (node.bounds[0][i] <= node.bounds[3][i])
+                box.extend(Eigen::AlignedBox3f(Vector3f(node.bounds[0][i], node.bounds[1][i], node.bounds[2][i]),
+                                               Vector3f(node.bounds[3][i], node.bounds[4][i], node.bounds[5][i])));
+        for (int k = 0; k < 3; ++k) {
+            quantizedNode.scale[k] = (box.max()[k] - box.min()[k]) / 253.f;
+            quantizedNode.origin[k] = box.min()[k] - quantizedNode.scale[k];
+        }
+
+        for (int i = 0; i < Width; ++i) {
+            bool empty = !(node.bounds[0][i] <= node.bounds[3][i]);
+            for (int k = 0; k < 3; ++k) {
+                float scale = quantizedNode.scale[k];
+                int qmin = 255, qmax = 0; // inverted box for the empty slots
+                if (!empty && scale > 0.f) {
+                    qmin = (int) std::floor((node.bounds[k][i] - quantizedNode.origin[k]) / scale) - 1;
+                    qmax = (int) std::ceil((node.bounds[3 + k][i] - quantizedNode.origin[k]) / scale) + 1;
+                } else if (!empty)
+                    qmin = qmax = 0;
+                quantizedNode.bounds[k][i] = (uint8_t) clamp(qmin, 0, 255);
+                quantizedNode.bounds[3 + k][i] = (uint8_t) clamp(qmax, 0, 255);
+            }
+
+            int first = 0, count = 1;
+            int child = empty ? -1 : node.child(i, first, count);
+            if (child >= 0)
+                quantizedNode.children[i] = child;
+            else {
+                if (count > (1 << QNode::LeafSizeBits) || first >= (1 << (31 - QNode::LeafSizeBits)))
+                    throw RTException("BVH: a leaf of %i faces starting at face %i cannot be compressed", count, first);
+                quantizedNode.children[i] = ~((first << QNode::LeafSizeBits) | (count - 1));
+            }
+        }
+    }
+}
+
+template <typename WideNodeType>
+bool BVH::intersectWide(const std::vector<WideNodeType>& wideNodes, const Ray& ray, Hit& hit) const
+{
+    constexpr int Width = WideNodeType::ChildCount;
+    // end of the interval, tightened by each hit
+    float tMax = std::min(ray.tMax, hit.t());
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (wideNodes.empty() || !intersectBox(m_box, traversalRay, tMax, tNear))
+        return false;
 
-        if (tMin1 <= tMin2) {
-            if (has_intersect1)
-                setIntersect([&] (auto& tmp_hit) { return intersectNode(index1, ray, tmp_hit); });
-            if (has_intersect2 && hit.t() >= tMin2)
-                setIntersect([&] (auto& tmp_hit) { return intersectNode(index2, ray, tmp_hit); });
+    // children still to visit (see WideNode::child()), with the distance at which the ray enters them
+    struct StackEntry {
+        int child;
+        int first_face;
+        int nb_faces;
+        float tNear;
+    };
+    StackEntry stack[TraversalStackSize * (Width - 1)];
+    int stackSize = 0;
+
+    bool found = false;
+    TriangleHit triangleHit;
+    int child = 0, first_face = 0, nb_faces = 0;
+    while (true) {
+        if (child < 0) {
+            // the faces only update the hit if they are closer
+            found |= intersectTriangles(ray, first_face, nb_faces, tMax, triangleHit);
+        } else {
+            ++ms_node_count;
+            const WideNodeType& node = wideNodes[child];
+            float tNears[Width];
+            int mask = intersectChildren(node, traversalRay, tMax, tNears);
+
+            // sort the intersected children by increasing entry distance
+            int order[Width];
+            int count = 0;
+            for (int i = 0; i < Width; ++i) {
+                if (!(mask & (1 << i)))
+                    continue;
+                int j = count++;
+                for (; j > 0 && tNears[order[j - 1]] > tNears[i]; --j)
+                    order[j] = order[j - 1];
+                order[j] = i;
+            }
+
+            // visit the nearest one, and push the others, the farthest first
+            if (count > 0) {
+                for (int j = count - 1; j > 0; --j) {
+                    StackEntry& entry = stack[stackSize++];
+                    entry.child = node.child(order[j], entry.first_face, entry.nb_faces);
+                    entry.tNear = tNears[order[j]];
+                }
+                child = node.child(order[0], first_face, nb_faces);
+                continue;
+            }
         }
-        else {
-            if (has_intersect2)
-                setIntersect([&] (auto& tmp_hit) { return intersectNode(index2, ray, tmp_hit); });
-            if (has_intersect1 && hit.t() >= tMin1)
-                setIntersect([&] (auto& tmp_hit) { return intersectNode(index1, ray, tmp_hit); });
+
+        // go on with the nearest pending child which is not behind the closest hit
+        while (stackSize > 0 && stack[stackSize - 1].tNear > tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        --stackSize;
+        child = stack[stackSize].child;
+        first_face = stack[stackSize].first_face;
+        nb_faces = stack[stackSize].nb_faces;
+    }
+    if (found) {
+        hit.setT(tMax);
+        hit.setPrimitive(m_faces[triangleHit.index], triangleHit.u, triangleHit.v);
+    }
+    return found;
+}
+
+template <typename WideNodeType>
+bool BVH::occludedWide(const std::vector<WideNodeType>& wideNodes, const Ray& ray) const
+{
+    constexpr int Width = WideNodeType::ChildCount;
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (wideNodes.empty() || !intersectBox(m_box, traversalRay, ray.tMax, tNear))
+        return false;
+
+    // children still to visit (see WideNode::child()), in any order since the first hit ends the traversal
+    struct StackEntry {
+        int child;
+        int first_face;
+        int nb_faces;
+    };
+    StackEntry stack[TraversalStackSize * (Width - 1) + 1];
+    int stackSize = 0;
+
+    int child = 0, first_face = 0, nb_faces = 0;
+    while (true) {
+        if (child < 0) {
+            if (occludedTriangles(ray, first_face, nb_faces))
+                return true;
+        } else {
+            ++ms_node_count;
+            const WideNodeType& node = wideNodes[child];
+            float tNears[Width];
+            int mask = intersectChildren(node, traversalRay, ray.tMax, tNears);
+            // push every intersected child, and visit the last one pushed
+            for (int i = 0; i < Width; ++i) {
+                if (!(mask & (1 << i)))
+                    continue;
+                StackEntry& entry = stack[stackSize++];
+                entry.child = node.child(i, entry.first_face, entry.nb_faces);
+            }
         }
+
+        if (stackSize == 0)
+            return false;
+        --stackSize;
+        child = stack[stackSize].child;
+        first_face = stack[stackSize].first_face;
+        nb_faces = stack[stackSize].nb_faces;
+    }
+}
+
+void BVH::alignLeaves()
+{
+    // the leaves are laid out in the order of their faces, which follows the tree
+    std::vector<int> leaves;
+    for (int nodeId = 0; nodeId < int(m_nodes.size()); ++nodeId)
+        if (m_nodes[nodeId].is_leaf)
+            leaves.push_back(nodeId);
+    std::sort(leaves.begin(), leaves.end(), [&](int a, int b) { return m_nodes[a].first_face_id < m_nodes[b].first_face_id; });
+
+    std::vector<int> faces;
+    faces.reserve(m_faces.size() + leaves.size() * (TrianglePacket::Width - 1));
+    for (int nodeId : leaves) {
+        Node& node = m_nodes[nodeId];
+        int first = int(faces.size());
+        faces.insert(faces.end(), m_faces.begin() + node.first_face_id, m_faces.begin() + node.first_face_id + node.nb_faces);
+        faces.resize((faces.size() + TrianglePacket::Width - 1) / TrianglePacket::Width * TrianglePacket::Width, -1);
+        node.first_face_id = first;
+    }
+    m_faces.swap(faces);
+}
+
+void BVH::buildPackets()
+{
+    int nbPackets = int(m_faces.size()) / TrianglePacket::Width;
+    m_packets.resize(nbPackets);
+    parallelChunks(0, nbPackets, getChunkCount(nbPackets, ParallelGrainSize / TrianglePacket::Width), [&](int, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            for (int lane = 0; lane < TrianglePacket::Width; ++lane) {
+                int faceId = m_faces[i * TrianglePacket::Width + lane];
+                if (faceId < 0)
+                    m_packets[i].clear(lane);
+                else
+                    m_packets[i].set(lane, m_pMesh->vertexOfFace(faceId, 0).position.data(),
+                                     m_pMesh->vertexOfFace(faceId, 1).position.data(), m_pMesh->vertexOfFace(faceId, 2).position.data());
+            }
+        }
+    });
+}
+
+bool BVH::intersectTriangles(const Ray& ray, int first, int count, float& tMax, TriangleHit& triangleHit) const
+{
+    Mesh::ms_itersection_count += count;
+    // the leaf starts on a packet, whose padding lanes are never hit
+    float u, v;
+    int index = intersectTrianglePackets(&m_packets[first / TrianglePacket::Width],
+                                         (count + TrianglePacket::Width - 1) / TrianglePacket::Width, ray, tMax, u, v);
+    if (index < 0)
+        return false;
+    triangleHit.index = first + index;
+    triangleHit.u = u;
+    triangleHit.v = v;
+    return true;
+}
+
+bool BVH::occludedTriangles(const Ray& ray, int first, int count) const
+{
+    Mesh::ms_itersection_count += count;
+    float t = ray.tMax, u, v;
+    return intersectTrianglePackets(&m_packets[first / TrianglePacket::Width],
+                                    (count + TrianglePacket::Width - 1) / TrianglePacket::Width, ray, t, u, v) >= 0;
+}
+
+void BVH::computeBounds(int start, int end, int chunkCount, Eigen::AlignedBox3f& box, Eigen::AlignedBox3f& centroidBox) const
+{
+    box.setEmpty();
+    centroidBox.setEmpty();
+    if (chunkCount == 1) {
+        for (int index = start; index < end; ++index) {
+            box.extend(m_faceBoxes[m_faces[index]]);
+            centroidBox.extend(m_centroids[m_faces[index]]);
+        }
+        return;
+    }
+
+    std::vector<Eigen::AlignedBox3f> boxes(chunkCount), centroidBoxes(chunkCount);
+    parallelChunks(start, end, chunkCount, [&](int chunk, int first, int last) {
+        for (int index = first; index < last; ++index) {
+            boxes[chunk].extend(m_faceBoxes[m_faces[index]]);
+            centroidBoxes[chunk].extend(m_centroids[m_faces[index]]);
+        }
+    });
+    for (int chunk = 0; chunk < chunkCount; ++chunk) {
+        box.extend(boxes[chunk]);
+        centroidBox.extend(centroidBoxes[chunk]);
     }
-    return has_intersect;
 }
 
 /** Sorts the faces with respect to their centroid along the dimension \a dim and spliting value \a split_value.
+  * The partition is stable, and done in parallel for large ranges.
   * \returns the middle index
   */
-int BVH::split(int start, int end, int dim, float split_value)
+int BVH::split(int start, int end, int dim, float split_value, int chunkCount)
 {
-    int l(start), r(end-1);
-    while(l<r)
-    {
-        // find the first on the left
-        while(l<end && m_centroids[l](dim) < split_value) ++l;
-        while(r>=start && m_centroids[r](dim) >= split_value) --r;
-        if(l>r) break;
-        std::swap(m_centroids[l], m_centroids[r]);
-        std::swap(m_faces[l], m_faces[r]);
-        ++l;
-        --r;
+    auto isLeft = [&](int faceId) { return m_centroids[faceId](dim) < split_value; };
+
+    if (chunkCount == 1) {
+        // the faces on the left are moved down in place, those on the right go through the scratch buffer
+        int left = start, right = start;
+        for (int index = start; index < end; ++index) {
+            int faceId = m_faces[index];
+            if (isLeft(faceId))
+                m_faces[left++] = faceId;
+            else
+                m_scratch[right++] = faceId;
+        }
+        std::copy(m_scratch.begin() + start, m_scratch.begin() + right, m_faces.begin() + left);
+        return left;
     }
-    return m_centroids[l][dim]<split_value ? l+1 : l;
+
+    // count the faces on the left of each chunk
+    std::vector<int> leftCounts(chunkCount + 1, 0);
+    parallelChunks(start, end, chunkCount, [&](int chunk, int first, int last) {
+        leftCounts[chunk + 1] = (int) std::count_if(m_faces.begin() + first, m_faces.begin() + last, isLeft);
+    });
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+        leftCounts[chunk + 1] += leftCounts[chunk];
+    int mid_id = start + leftCounts[chunkCount];
+
+    // then move each chunk to its place in the scratch buffer, and copy it back
+    parallelChunks(start, end, chunkCount, [&](int chunk, int first, int last) {
+        int left = start + leftCounts[chunk];
+        int right = mid_id + (first - start) - leftCounts[chunk];
+        for (int index = first; index < last; ++index) {
+            int faceId = m_faces[index];
+            m_scratch[isLeft(faceId) ? left++ : right++] = faceId;
+        }
+    });
+    parallelChunks(start, end, chunkCount, [&](int, int first, int last) {
+        std::copy(m_scratch.begin() + first, m_scratch.begin() + last, m_faces.begin() + first);
+    });
+    return mid_id;
 }
 
-void BVH::buildNode(int nodeId, int start, int end, int level, int targetCellSize, int maxDepth)
+bool BVH::findSAHSplit(int start, int end, int chunkCount, const Eigen::AlignedBox3f& box, const Eigen::AlignedBox3f& centroidBox,
+                       int& dim, float& split_value, float& cost) const
 {
-    // étape 1 : calculer la boite englobante des faces indexées de m_faces[start] à m_faces[end]
-    // (Utiliser la fonction extend de Eigen::AlignedBox3f et la fonction mpMesh->vertexOfFace(int) pour obtenir les coordonnées des sommets des faces)
-    // Initialize box with first vertex of first face
-    Eigen::AlignedBox3f box { m_pMesh->vertexOfFace(m_faces[start], 0).position };
-    for (int index = start; index < end; ++index) {
-        for (int pindex = 0; pindex < 3; ++pindex) {
-            auto p = m_pMesh->vertexOfFace(m_faces[index], pindex);
-            box.extend(p.position);
+    struct Bin {
+        Eigen::AlignedBox3f box;
+        int count = 0;
+    };
+    typedef std::array<std::array<Bin, SAHBinCount>, 3> Bins;
+
+    Vector3f minValue = centroidBox.min();
+    Vector3f extent = centroidBox.diagonal();
+    auto binOf = [&](int faceId, int axis) {
+        return std::min(int(SAHBinCount * (m_centroids[faceId](axis) - minValue(axis)) / extent(axis)), SAHBinCount - 1);
+    };
+
+    // distribute the faces into bins according to their centroid, each chunk having its own bins
+    auto fillBins = [&](Bins& bins, int first, int last) {
+        for (int index = first; index < last; ++index) {
+            int faceId = m_faces[index];
+            for (int axis = 0; axis < 3; ++axis) {
+                if (!(extent(axis) > 0.f))
+                    continue;
+                Bin& bin = bins[axis][binOf(faceId, axis)];
+                bin.count++;
+                bin.box.extend(m_faceBoxes[faceId]);
+            }
+        }
+    };
+    Bins allBins;
+    if (chunkCount == 1) {
+        fillBins(allBins, start, end);
+    } else {
+        std::vector<Bins> chunkBins(chunkCount);
+        parallelChunks(start, end, chunkCount, [&](int chunk, int first, int last) { fillBins(chunkBins[chunk], first, last); });
+        for (int chunk = 0; chunk < chunkCount; ++chunk) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (int b = 0; b < SAHBinCount; ++b) {
+                    allBins[axis][b].count += chunkBins[chunk][axis][b].count;
+                    allBins[axis][b].box.extend(chunkBins[chunk][axis][b].box);
+                }
+            }
         }
     }
+
+    float invArea = 1.f / std::max(surfaceArea(box), std::numeric_limits<float>::min());
+    bool found = false;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (!(extent(axis) > 0.f))
+            continue;
+        const std::array<Bin, SAHBinCount>& bins = allBins[axis];
+
+        // sweep from the right to get the area and number of faces on the right of each plane
+        float rightArea[SAHBinCount];
+        int rightCount[SAHBinCount];
+        Eigen::AlignedBox3f rightBox;
+        int count = 0;
+        for (int b = SAHBinCount - 1; b > 0; --b) {
+            rightBox.extend(bins[b].box);
+            count += bins[b].count;
+            rightArea[b] = surfaceArea(rightBox);
+            rightCount[b] = count;
+        }
+
+        // then from the left, evaluating the cost of the plane between the bins b-1 and b
+        Eigen::AlignedBox3f leftBox;
+        count = 0;
+        for (int b = 1; b < SAHBinCount; ++b) {
+            leftBox.extend(bins[b - 1].box);
+            count += bins[b - 1].count;
+            if (count == 0 || rightCount[b] == 0)
+                continue;
+            float c = TraversalCost + invArea *
+                      (intersectionCost(count) * surfaceArea(leftBox) + intersectionCost(rightCount[b]) * rightArea[b]);
+            if (!found || c < cost) {
+                found = true;
+                cost = c;
+                dim = axis;
+                split_value = minValue(axis) + extent(axis) * b / SAHBinCount;
+            }
+        }
+    }
+    return found;
+}
+
+void BVH::buildNode(int nodeId, int start, int end, int level, int targetCellSize, int maxDepth, bool concurrent)
+{
+    int nbFaces = end - start;
+    int chunkCount = concurrent ? 1 : getChunkCount(nbFaces, ParallelGrainSize);
+
+    // étape 1 : calculer la boite englobante des faces indexées de m_faces[start] à m_faces[end]
+    Eigen::AlignedBox3f box, centroidBox;
+    computeBounds(start, end, chunkCount, box, centroidBox);
+
     // étape 2 : déterminer si il s'agit d'une feuille (appliquer les critères d'arrêts)
+    bool leaf = level >= maxDepth || nbFaces <= 1;
+    int dim = 0;
+    float split_value = 0.f;
+    bool hasSplit = false;
 
-    if (end - start <= targetCellSize || level >= maxDepth) {
+    if (!leaf && m_method == SplitSAH) {
+        // with the SAH, a node becomes a leaf when intersecting all its faces is cheaper than splitting it
+        float cost;
+        hasSplit = findSAHSplit(start, end, chunkCount, box, centroidBox, dim, split_value, cost);
+        if (nbFaces <= targetCellSize && (!hasSplit || cost >= intersectionCost(nbFaces)))
+            leaf = true;
+    } else if (nbFaces <= targetCellSize)
+        leaf = true;
+
+    if (leaf) {
     // Si c'est une feuille, finaliser le noeud et quitter la fonction
         m_nodes[nodeId].is_leaf = true;
-        m_nodes[nodeId].nb_faces = end - start;
+        m_nodes[nodeId].nb_faces = nbFaces;
         m_nodes[nodeId].first_face_id = start;
         m_nodes[nodeId].box = box;
         return;
     }
 
-
     // Si c'est un noeud interne :
     // étape 3 : calculer l'index de la dimension (x=0, y=1, ou z=2) et la valeur du plan de coupe
-    // (on découpe au milieu de la boite selon la plus grande dimension)
-    const auto max_corner = box.max();
-    const auto min_corner = box.min();
-
-    auto x_diff = max_corner.x() - min_corner.x();
-    auto y_diff = max_corner.y() - min_corner.y();
-    auto z_diff = max_corner.z() - min_corner.z();
-
-    int dim;
-    if (x_diff > y_diff && x_diff > z_diff)
-        dim = 0;
-    else if (y_diff > z_diff)
-        dim = 1;
-    else 
-        dim = 2;
-    auto split_value = (max_corner(dim) + min_corner(dim)) / 2;
+    // (avec la méthode du point milieu, on découpe au milieu de la boite selon la plus grande dimension)
+    Vector3f diagonal = box.diagonal();
+    int largest = 0;
+    if (diagonal.y() > diagonal(largest)) largest = 1;
+    if (diagonal.z() > diagonal(largest)) largest = 2;
+    if (!hasSplit) {
+        dim = largest;
+        split_value = box.center()(dim);
+    }
 
     // étape 4 : appeler la fonction split pour trier (partiellement) les faces et vérifier si le split a été utile
-    auto mid_id = split(start, end, dim, split_value);
-
-    // étape 5 : allouer les fils, et les construire en appelant buildNode...
-    m_nodes.push_back({});
-    m_nodes.push_back({});
+    int mid_id = split(start, end, dim, split_value, chunkCount);
+    if (mid_id == start || mid_id == end) {
+        // all the centroids are on the same side, split the faces in two halves along the largest axis instead
+        mid_id = start + nbFaces / 2;
+        std::nth_element(m_faces.begin() + start, m_faces.begin() + mid_id, m_faces.begin() + end,
+                         [&](int a, int b) { return m_centroids[a](largest) < m_centroids[b](largest); });
+    }
 
-    m_nodes[nodeId].first_child_id = m_nodes.size() - 2;
+    // étape 5 : allouer les fils dans le tableau pré-alloué, et les construire en appelant buildNode...
+    int first_child_id = m_nodeCount.fetch_add(2);
+    m_nodes[nodeId].first_child_id = first_child_id;
     m_nodes[nodeId].box = box;
-    m_nodes[nodeId].nb_faces = end - start;
+    m_nodes[nodeId].nb_faces = nbFaces;
 
-    buildNode(m_nodes[nodeId].first_child_id, start, mid_id, level+1, targetCellSize, maxDepth);
-    buildNode(m_nodes[nodeId].first_child_id + 1, mid_id, end, level+1, targetCellSize, maxDepth);
+    // the large subtrees are built concurrently, as long as there are idle cores
+    bool spawn = false;
+    if (nbFaces >= ParallelSubtreeSize) {
+        spawn = m_buildThreads.fetch_add(1) < getCoreCount();
+        if (!spawn)
+            m_buildThreads--;
+    }
+
+    if (spawn) {
+        // the cores are then shared by the subtrees, whose loops are no longer split in chunks
+        std::thread left([=]() { buildNode(first_child_id, start, mid_id, level+1, targetCellSize, maxDepth, true); });
+        buildNode(first_child_id + 1, mid_id, end, level+1, targetCellSize, maxDepth, true);
+        left.join();
+        m_buildThreads--;
+    } else {
+        buildNode(first_child_id, start, mid_id, level+1, targetCellSize, maxDepth, concurrent);
+        buildNode(first_child_id + 1, mid_id, end, level+1, targetCellSize, maxDepth, concurrent);
+    }
+}
+
+BVH::Statistics BVH::computeStatistics() const
+{
+    Statistics stats;
+    if (m_nodes.empty())
+        return stats;
+
+    float invRootArea = 1.f / std::max(surfaceArea(m_nodes[0].box), std::numeric_limits<float>::min());
+    std::vector<std::pair<int, int>> stack { { 0, 0 } };
+    while (!stack.empty()) {
+        int nodeId = stack.back().first, depth = stack.back().second;
+        stack.pop_back();
+        const Node& node = m_nodes[nodeId];
+        float probability = surfaceArea(node.box) * invRootArea;
+        stats.nodeCount++;
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+        if (node.is_leaf) {
+            stats.leafCount++;
+            stats.maxLeafSize = std::max(stats.maxLeafSize, int(node.nb_faces));
+            stats.sahCost += probability * intersectionCost(node.nb_faces);
+        } else {
+            stats.sahCost += probability * TraversalCost;
+            stack.push_back({ node.first_child_id, depth + 1 });
+            stack.push_back({ node.first_child_id + 1, depth + 1 });
+        }
+    }
+    return stats;
+}
+
+size_t BVH::getMemoryUsage() const
+{
+    return m_nodes.size() * sizeof(Node) + m_faces.size() * sizeof(int) + m_packets.size() * sizeof(TrianglePacket)
+         + m_wideNodes4.size() * sizeof(WideNode<4>) + m_wideNodes8.size() * sizeof(WideNode<8>)
+         + m_quantizedNodes4.size() * sizeof(QuantizedNode<4>) + m_quantizedNodes8.size() * sizeof(QuantizedNode<8>);
+}
+
+std::string BVH::toString() const
+{
+    const Statistics& stats = m_statistics;
+    return tfm::format(
+        "BVH[\n"
+        "  split = %s,\n"
+        "  width = %i,\n"
+        "  compressed = %s,\n"
+        "  nodeCount = %i,\n"
+        "  leafCount = %i,\n"
+        "  maxDepth = %i,\n"
+        "  averageLeafSize = %.2f,\n"
+        "  maxLeafSize = %i,\n"
+        "  sahCost = %.2f,\n"
+        "  memory = %s (%.1f bytes per triangle, %.1f for the binary tree),\n"
+        "  buildTime = %s\n"
+        "]",
+        m_method == SplitSAH ? "sah" : "midpoint", m_width, m_compressed ? "true" : "false",
+        stats.nodeCount, stats.leafCount, stats.maxDepth,
+        stats.leafCount ? float(m_pMesh->nbFaces()) / stats.leafCount : 0.f,
+        stats.maxLeafSize, stats.sahCost,
+        memString(getMemoryUsage()), float(getMemoryUsage()) / std::max(m_pMesh->nbFaces(), 1),
+        float(m_binaryMemoryUsage) / std::max(m_pMesh->nbFaces(), 1),
+        timeString(m_buildTime, true));
 }
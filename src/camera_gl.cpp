@@ -0,0 +1,100 @@
+
+// Copyright (C) 2008 Gael Guennebaud <gael.guennebaud@inria.fr>
+//
+// Eigen is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3 of the License, or (at your option) any later version.
+//
+// Alternatively, you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of
+// the License, or (at your option) any later version.
+//
+// Eigen is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License or the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License and a copy of the GNU General Public License along with
+// Eigen. If not, see <http://www.gnu.org/licenses/>.
+
+#include "camera.h"
+
+#include <nanogui/glutil.h>
+
+/* The OpenGL drawing code of the camera lives apart from camera.cpp,
+   so that the core of the raytracer does not depend on OpenGL. */
+
+void Camera::draw(nanogui::GLShader* prg)
+{
+    if(!mIsInitialized)
+    {
+        mIsInitialized = true;
+        mPoints.clear();
+
+        // grille
+        float ym = tan(mFovY*0.5);
+        float xm = ((float)mVpWidth)*(ym*1.0/mVpHeight);
+        float zm = 0.75f;
+        for(uint x=1; x<mVpWidth; ++x){
+            mPoints.push_back(Point3f(xm*(x*2.0/mVpWidth-1.0),ym,-zm));
+            mPoints.push_back(Point3f(xm*(x*2.0/mVpWidth-1.0),-ym,-zm));
+        }
+        for(uint y=1; y<mVpHeight; ++y){
+            mPoints.push_back(Point3f(xm,ym*(y*2.0/mVpHeight-1.0),-zm));
+            mPoints.push_back(Point3f(-xm,ym*(y*2.0/mVpHeight-1.0),-zm));
+        }
+
+        //pyramide
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(xm,ym,-zm));
+        mPoints.push_back(Point3f(xm,ym,-zm));
+        mPoints.push_back(Point3f(xm,-ym,-zm));
+        mPoints.push_back(Point3f(xm,-ym,-zm));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(-xm,ym,-zm));
+        mPoints.push_back(Point3f(-xm,ym,-zm));
+        mPoints.push_back(Point3f(-xm,-ym,-zm));
+        mPoints.push_back(Point3f(-xm,-ym,-zm));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(xm,ym,-zm));
+        mPoints.push_back(Point3f(xm,ym,-zm));
+        mPoints.push_back(Point3f(-xm,ym,-zm));
+        mPoints.push_back(Point3f(-xm,ym,-zm));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+        mPoints.push_back(Point3f(xm,-ym,-zm));
+        mPoints.push_back(Point3f(xm,-ym,-zm));
+        mPoints.push_back(Point3f(-xm,-ym,-zm));
+        mPoints.push_back(Point3f(-xm,-ym,-zm));
+        mPoints.push_back(Point3f(0.0,0.0,0.0));
+
+        glGenBuffers(1,&mVertexBufferId);
+        glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(Point3f)*mPoints.size(), mPoints[0].data(), GL_STATIC_DRAW);
+
+        glGenVertexArrays(1,&mVertexArrayId);
+    }
+
+    // bind the vertex array
+    glBindVertexArray(mVertexArrayId);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
+
+    int vertex_loc = prg->attrib("vtx_position");
+    glVertexAttribPointer(vertex_loc, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(vertex_loc);
+
+    glUniformMatrix4fv(prg->uniform("mat_obj"), 1, GL_FALSE, mFrame.getMatrix().data());
+
+    glDrawArrays(GL_LINES,0,mPoints.size());
+
+    glDisableVertexAttribArray(vertex_loc);
+
+    // release the vertex array
+    glBindVertexArray(0);
+}
@@ -23,7 +23,11 @@
 #include <Eigen/Geometry>
 #include <Eigen/LU>
 #include <filesystem/resolver.h>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
+#include <iterator>
+#include <thread>
 
 #if defined(PLATFORM_LINUX)
 #include <malloc.h>
@@ -37,6 +41,73 @@
 #include <sys/sysctl.h>
 #endif
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+int getCoreCount() {
+    // querying the system is slow, and this is called in the inner loops of the BVH construction
+    static const int coreCount = std::max(1u, std::thread::hardware_concurrency());
+    return coreCount;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed) {
+    auto mix = [](uint64_t h) {
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    };
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes, size);
+    return mix(h ^ tail);
+}
+
+MappedFile::MappedFile(const std::string &filename) {
+#if !defined(_WIN32)
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0)
+            close(fd);
+        throw RTException("Unable to open \"%s\"", filename);
+    }
+    m_size = (size_t) st.st_size;
+    if (m_size > 0) {
+        void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+            m_data = (const char *) data;
+    }
+    close(fd);
+    if (m_data || m_size == 0)
+        return;
+#endif
+    /* Fall back to reading the whole file */
+    std::ifstream is(filename, std::ios::binary);
+    if (is.fail())
+        throw RTException("Unable to open \"%s\"", filename);
+    m_buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+    if (m_buffer.empty() && m_data)
+        munmap((void *) m_data, m_size);
+#endif
+}
+
 std::string indent(const std::string &string, int amount) {
     /* This could probably be done faster (it's not
        really speed-critical though) */
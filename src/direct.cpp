@@ -32,12 +32,10 @@ public:
                 float dist;
                 // Vector from intersect point + Epsilon to the light
                 Ray shadow_ray(ray_o, light->direction(ray_o, &dist));
-                Hit shadow_hit;
-                scene->intersect(shadow_ray, shadow_hit);
+                // The shadow ray stops just before the light
+                shadow_ray.tMax = dist - Epsilon;
 
-                if (shadow_hit.t() < dist - Epsilon) {
-                }
-                else {
+                if (!scene->occluded(shadow_ray)) {
                     Vector3f lightDir = light->direction(intersect_point);
 
                     // Calling brdf method without considering last uv parameter used later for textures
@@ -0,0 +1,56 @@
+#include "sampler.h"
+
+/**
+ * \brief Halton low-discrepancy sampler
+ *
+ * Dimension i of the n-th sample of a pixel is the radical inverse of n in
+ * the i-th prime base. To avoid the same pattern in every pixel, each pixel
+ * applies its own random toroidal shift (Cranley-Patterson rotation) to the
+ * sequence. Dimensions beyond the table of primes are independent.
+ */
+class Halton : public Sampler
+{
+public:
+    Halton(const PropertyList &propList)
+        : Sampler(propList) {}
+
+    Sampler *clone() const { return new Halton(*this); }
+
+    float next1D() {
+        return sample(m_dimension++);
+    }
+
+    Point2f next2D() {
+        float x = sample(m_dimension++);
+        return Point2f(x, sample(m_dimension++));
+    }
+
+    std::string toString() const {
+        return tfm::format("Halton[sampleCount = %i]", m_sampleCount);
+    }
+
+protected:
+    /// \returns the radical inverse of \a index in base \a base
+    static float radicalInverse(int base, uint32_t index) {
+        const float invBase = 1.f / base;
+        float invBaseN = 1.f, result = 0.f;
+        while (index > 0) {
+            uint32_t next = index / base;
+            result += (index - next * base) * (invBaseN *= invBase);
+            index = next;
+        }
+        return std::min(result, 0x1.fffffep-1f);
+    }
+
+    float sample(int dimension) {
+        static const int primes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+        if (dimension >= int(sizeof(primes) / sizeof(primes[0])))
+            return m_random.nextFloat();
+
+        float shift = hash(m_pixelSeed, dimension) * 0x1p-32f;
+        float value = radicalInverse(primes[dimension], m_sampleIndex) + shift;
+        return value >= 1.f ? value - 1.f : value;
+    }
+};
+
+REGISTER_CLASS(Halton, "halton")
@@ -0,0 +1,30 @@
+#include "sampler.h"
+
+/**
+ * \brief Independent sampler: every sample component is uniformly random
+ */
+class Independent : public Sampler
+{
+public:
+    Independent(const PropertyList &propList)
+        : Sampler(propList) {}
+
+    Sampler *clone() const { return new Independent(*this); }
+
+    float next1D() {
+        ++m_dimension;
+        return m_random.nextFloat();
+    }
+
+    Point2f next2D() {
+        m_dimension += 2;
+        float x = m_random.nextFloat();
+        return Point2f(x, m_random.nextFloat());
+    }
+
+    std::string toString() const {
+        return tfm::format("Independent[sampleCount = %i]", m_sampleCount);
+    }
+};
+
+REGISTER_CLASS(Independent, "independent")
@@ -0,0 +1,47 @@
+#include "instance.h"
+#include "mesh.h"
+
+Instance::Instance(const PropertyList &propList)
+{
+    m_mesh = Mesh::loadShared(propList);
+    m_toWorld = propList.getTransform("toWorld", Transform());
+    m_toObject = m_toWorld.inverse();
+
+    // box of the transformed corners of the box of the mesh
+    const Eigen::AlignedBox3f& box = m_mesh->AABB();
+    if (!box.isEmpty())
+        for (int corner = 0; corner < 8; ++corner)
+            m_AABB.extend(m_toWorld * Point3f(box.corner(Eigen::AlignedBox3f::CornerType(corner))));
+}
+
+bool Instance::intersect(const Ray& ray, Hit& hit) const
+{
+    // the direction is not normalized, so that the distances, and the interval of the ray, are the same in both spaces
+    return m_mesh->intersect(m_toObject * ray, hit);
+}
+
+bool Instance::occluded(const Ray& ray) const
+{
+    return m_mesh->occluded(m_toObject * ray);
+}
+
+void Instance::computeSurfaceInteraction(const Ray& ray, Hit& hit) const
+{
+    m_mesh->computeSurfaceInteraction(m_toObject * ray, hit);
+    hit.setNormal((m_toWorld * hit.normal()).normalized());
+}
+
+std::string Instance::toString() const
+{
+    return tfm::format(
+        "Instance[\n"
+        "  mesh = %s,\n"
+        "  toWorld = %s,\n"
+        "  material = %s\n"
+        "]",
+        indent(m_mesh->toString()),
+        indent(m_toWorld.toString(), 12),
+        m_material ? indent(m_material->toString()) : std::string("null"));
+}
+
+REGISTER_CLASS(Instance, "instance")
@@ -0,0 +1,112 @@
+
+#include "kernels.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#if defined(MDS3D_X86_KERNELS)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace generic { extern const Kernels table; }
+#if defined(MDS3D_X86_KERNELS)
+namespace sse42 { extern const Kernels table; }
+namespace avx2 { extern const Kernels table; }
+namespace avx512 { extern const Kernels table; }
+#endif
+
+#if defined(MDS3D_X86_KERNELS)
+
+static void cpuid(int leaf, unsigned int registers[4])
+{
+#if defined(_MSC_VER)
+    __cpuidex(reinterpret_cast<int*>(registers), leaf, 0);
+#else
+    __cpuid_count(leaf, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+/// \returns the register XCR0, which tells the vector registers saved by the operating system
+static uint64_t xgetbv()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+/// \returns the kernels of the best instruction set supported by both the CPU and the operating system
+static const Kernels* detectKernels()
+{
+    unsigned int registers[4];
+    cpuid(0, registers);
+    unsigned int maxLeaf = registers[0];
+    cpuid(1, registers);
+    unsigned int ecx1 = registers[2];
+    unsigned int ebx7 = 0;
+    if (maxLeaf >= 7) {
+        cpuid(7, registers);
+        ebx7 = registers[1];
+    }
+
+    // -msse4.2 also enables SSE3, SSSE3 and SSE4.1, which the compiler may use in the sse4.2 kernels
+    const unsigned int sse42Bits = (1u << 0) | (1u << 9) | (1u << 19) | (1u << 20);
+    bool sse42 = (ecx1 & sse42Bits) == sse42Bits;
+    // the AVX registers can only be used if the operating system saves them (OSXSAVE, then XCR0)
+    uint64_t xcr0 = (ecx1 & (1u << 27)) ? xgetbv() : 0;
+    bool avxState = (xcr0 & 0x6) == 0x6;
+    bool avx512State = (xcr0 & 0xe6) == 0xe6;
+    // the avx2 and avx512 kernels are compiled with -mfma, so FMA is required along with AVX and AVX2
+    bool avx2 = sse42 && avxState && (ecx1 & (1u << 28)) && (ecx1 & (1u << 12)) && (ebx7 & (1u << 5));
+    bool avx512 = avx2 && avx512State && (ebx7 & (1u << 16)) && (ebx7 & (1u << 17)) && (ebx7 & (1u << 30))
+                  && (ebx7 & (1u << 31));
+
+    if (avx512)
+        return &avx512::table;
+    if (avx2)
+        return &avx2::table;
+    if (sse42)
+        return &sse42::table;
+    return &generic::table;
+}
+
+#endif
+
+static const Kernels* selectKernels()
+{
+    // from the lowest instruction set to the highest
+#if defined(MDS3D_X86_KERNELS)
+    const Kernels* available[] = { &generic::table, &sse42::table, &avx2::table, &avx512::table };
+    const Kernels* best = detectKernels();
+#else
+    const Kernels* available[] = { &generic::table };
+    const Kernels* best = &generic::table;
+#endif
+    const int nbAvailable = int(sizeof(available) / sizeof(available[0]));
+
+    // an instruction set can be forced, as long as the CPU supports it
+    const char* forced = getenv("MDS3D_ISA");
+    if (forced && *forced) {
+        for (int i = 0; i < nbAvailable; ++i) {
+            if (strcmp(available[i]->isa, forced) != 0)
+                continue;
+            for (int j = i; j < nbAvailable; ++j)
+                if (available[j] == best)
+                    return available[i];
+            std::cerr << "Kernels: \"" << forced << "\" is not supported by this CPU, using " << best->isa << std::endl;
+            return best;
+        }
+        std::cerr << "Kernels: unknown instruction set \"" << forced << "\", using " << best->isa << std::endl;
+    }
+    return best;
+}
+
+// selected before main(), so that the kernels are called without any check
+const Kernels* const selectedKernels = selectKernels();
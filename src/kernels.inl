@@ -0,0 +1,463 @@
+/* Source of the kernels of kernels.h, included by one translation unit per instruction set,
+   which defines KERNELS_NAMESPACE and KERNELS_ISA and is compiled with the matching flags.
+
+   Everything is defined in KERNELS_NAMESPACE and only plain C functions are called: an inline
+   function of a shared header (Eigen, std::min...) would be compiled for this instruction set, and
+   the linker could keep this copy for the whole program. The compiler must not contract the
+   multiplications and additions either, so that every variant gives the same images. */
+
+#include "kernels.h"
+#include "trianglepacket.h"
+#include "spherepacket.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include <math.h>
+#include <string.h>
+
+namespace KERNELS_NAMESPACE {
+
+/* Determinant below which a ray is considered as parallel to a triangle, as in Mesh::intersectFace() */
+static const float ParallelEpsilon = 1e-6f;
+
+/// Rows of child boxes stored as floats
+template <int Width>
+struct FloatRows
+{
+    const float (*bounds)[Width];
+
+    float load(int row, int i) const { return bounds[row][i]; }
+#if defined(__SSE2__)
+    __m128 load4(int row, int i) const { return _mm_load_ps(&bounds[row][i]); }
+#endif
+#if defined(__AVX2__)
+    __m256 load8(int row, int i) const { return _mm256_load_ps(&bounds[row][i]); }
+#endif
+};
+
+/// Rows of child boxes quantized to 8 bits, decoded as they are loaded
+template <int Width>
+struct QuantizedRows
+{
+    const uint8_t (*bounds)[Width];
+    const float* boxOrigin;
+    const float* scale;
+
+    float load(int row, int i) const { return boxOrigin[row % 3] + bounds[row][i] * scale[row % 3]; }
+#if defined(__SSE2__)
+    __m128 load4(int row, int i) const {
+        int32_t bytes;
+        memcpy(&bytes, &bounds[row][i], sizeof(bytes));
+        __m128i packed = _mm_cvtsi32_si128(bytes);
+#if defined(__SSE4_1__)
+        __m128i values = _mm_cvtepu8_epi32(packed);
+#else
+        __m128i zero = _mm_setzero_si128();
+        __m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(packed, zero), zero);
+#endif
+        return _mm_add_ps(_mm_set1_ps(boxOrigin[row % 3]), _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(scale[row % 3])));
+    }
+#endif
+#if defined(__AVX2__)
+    __m256 load8(int row, int i) const {
+        __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&bounds[row][i])));
+        return _mm256_add_ps(_mm256_set1_ps(boxOrigin[row % 3]),
+                             _mm256_mul_ps(_mm256_cvtepi32_ps(values), _mm256_set1_ps(scale[row % 3])));
+    }
+#endif
+};
+
+/* Slab test between a ray and Width boxes, whose 6 rows (minimal x, y, z then maximal x, y, z
+   coordinates) are given by Rows */
+template <int Width, typename Rows>
+static int intersectRows(const Rows& rows, const float* origin, const float* invDirection, const int* sign,
+                         float tMax, float* tNear)
+{
+    // index of the rows of the near and far planes along each axis
+    const int nearRow[3] = { 3 * sign[0], 1 + 3 * sign[1], 2 + 3 * sign[2] };
+    const int farRow[3] = { 3 - 3 * sign[0], 4 - 3 * sign[1], 5 - 3 * sign[2] };
+    int mask = 0;
+#if defined(__AVX2__)
+    if (Width % 8 == 0) {
+        for (int group = 0; group < Width; group += 8) {
+            __m256 tEnter = _mm256_set1_ps(-3.402823466e+38f);
+            __m256 tExit = _mm256_set1_ps(tMax);
+            for (int k = 0; k < 3; ++k) {
+                __m256 o = _mm256_set1_ps(origin[k]);
+                __m256 invD = _mm256_set1_ps(invDirection[k]);
+                __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(rows.load8(nearRow[k], group), o), invD);
+                __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(rows.load8(farRow[k], group), o), invD);
+                // the current bounds as second operand, which is returned for a NaN
+                tEnter = _mm256_max_ps(t0, tEnter);
+                tExit = _mm256_min_ps(t1, tExit);
+            }
+            __m256 valid = _mm256_and_ps(_mm256_cmp_ps(tExit, _mm256_setzero_ps(), _CMP_GT_OQ),
+                                         _mm256_cmp_ps(tEnter, tExit, _CMP_LE_OQ));
+            _mm256_storeu_ps(tNear + group, tEnter);
+            mask |= _mm256_movemask_ps(valid) << group;
+        }
+        return mask;
+    }
+#endif
+#if defined(__SSE2__)
+    if (Width % 4 == 0) {
+        for (int group = 0; group < Width; group += 4) {
+            __m128 tEnter = _mm_set1_ps(-3.402823466e+38f);
+            __m128 tExit = _mm_set1_ps(tMax);
+            for (int k = 0; k < 3; ++k) {
+                __m128 o = _mm_set1_ps(origin[k]);
+                __m128 invD = _mm_set1_ps(invDirection[k]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(rows.load4(nearRow[k], group), o), invD);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(rows.load4(farRow[k], group), o), invD);
+                tEnter = _mm_max_ps(t0, tEnter);
+                tExit = _mm_min_ps(t1, tExit);
+            }
+            __m128 valid = _mm_and_ps(_mm_cmpgt_ps(tExit, _mm_setzero_ps()), _mm_cmple_ps(tEnter, tExit));
+            _mm_storeu_ps(tNear + group, tEnter);
+            mask |= _mm_movemask_ps(valid) << group;
+        }
+        return mask;
+    }
+#endif
+    for (int i = 0; i < Width; ++i) {
+        float tEnter = -3.402823466e+38f, tExit = tMax;
+        for (int k = 0; k < 3; ++k) {
+            float t0 = (rows.load(nearRow[k], i) - origin[k]) * invDirection[k];
+            float t1 = (rows.load(farRow[k], i) - origin[k]) * invDirection[k];
+            tEnter = t0 > tEnter ? t0 : tEnter;
+            tExit = t1 < tExit ? t1 : tExit;
+        }
+        tNear[i] = tEnter;
+        if (tExit > 0.f && tEnter <= tExit)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+template <int Width>
+static int intersectBoxes(const float (*bounds)[Width], const float* origin, const float* invDirection, const int* sign,
+                          float tMax, float* tNear)
+{
+    return intersectRows<Width>(FloatRows<Width>{ bounds }, origin, invDirection, sign, tMax, tNear);
+}
+
+template <int Width>
+static int intersectQuantizedBoxes(const uint8_t (*bounds)[Width], const float* boxOrigin, const float* scale,
+                                   const float* origin, const float* invDirection, const int* sign, float tMax, float* tNear)
+{
+    return intersectRows<Width>(QuantizedRows<Width>{ bounds, boxOrigin, scale }, origin, invDirection, sign, tMax, tNear);
+}
+
+#if defined(__SSE2__)
+
+/** Test a ray against the triangles of \a packet.
+  * \returns the bit mask of the lanes hit between \a tMin and \a tMax, their distances and barycentric coordinates
+  * being returned in \a t, \a u, \a v */
+static inline int intersectLanes4(const TrianglePacket& packet, const float* origin, const float* direction, float tMin,
+                                  float tMax, float* t, float* u, float* v)
+{
+    __m128 o[3], d[3], p0[3], e1[3], e2[3];
+    for (int k = 0; k < 3; ++k) {
+        o[k] = _mm_set1_ps(origin[k]);
+        d[k] = _mm_set1_ps(direction[k]);
+        p0[k] = _mm_load_ps(packet.p0[k]);
+        e1[k] = _mm_load_ps(packet.edge1[k]);
+        e2[k] = _mm_load_ps(packet.edge2[k]);
+    }
+    // pvec = d x e2
+    __m128 pvec0 = _mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1]));
+    __m128 pvec1 = _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2]));
+    __m128 pvec2 = _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]));
+    __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], pvec0), _mm_mul_ps(e1[1], pvec1)), _mm_mul_ps(e1[2], pvec2));
+    __m128 absDeterminant = _mm_andnot_ps(_mm_set1_ps(-0.f), determinant);
+    __m128 valid = _mm_cmpge_ps(absDeterminant, _mm_set1_ps(ParallelEpsilon));
+    __m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.f), determinant);
+
+    __m128 tvec0 = _mm_sub_ps(o[0], p0[0]), tvec1 = _mm_sub_ps(o[1], p0[1]), tvec2 = _mm_sub_ps(o[2], p0[2]);
+    __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvec0, pvec0), _mm_mul_ps(tvec1, pvec1)), _mm_mul_ps(tvec2, pvec2)), invDeterminant);
+    // qvec = tvec x e1
+    __m128 qvec0 = _mm_sub_ps(_mm_mul_ps(tvec1, e1[2]), _mm_mul_ps(tvec2, e1[1]));
+    __m128 qvec1 = _mm_sub_ps(_mm_mul_ps(tvec2, e1[0]), _mm_mul_ps(tvec0, e1[2]));
+    __m128 qvec2 = _mm_sub_ps(_mm_mul_ps(tvec0, e1[1]), _mm_mul_ps(tvec1, e1[0]));
+    __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], qvec0), _mm_mul_ps(d[1], qvec1)), _mm_mul_ps(d[2], qvec2)), invDeterminant);
+    __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], qvec0), _mm_mul_ps(e2[1], qvec1)), _mm_mul_ps(e2[2], qvec2)), invDeterminant);
+
+    // the comparisons are false for the NaNs of the degenerate lanes
+    __m128 zero = _mm_setzero_ps();
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmpge_ps(vv, zero)));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.f)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, _mm_set1_ps(tMin)), _mm_cmplt_ps(tt, _mm_set1_ps(tMax))));
+    _mm_storeu_ps(t, tt);
+    _mm_storeu_ps(u, uu);
+    _mm_storeu_ps(v, vv);
+    return _mm_movemask_ps(valid);
+}
+
+#else
+
+static inline int intersectLanes4(const TrianglePacket& packet, const float* origin, const float* direction, float tMin,
+                                  float tMax, float* t, float* u, float* v)
+{
+    int mask = 0;
+    for (int i = 0; i < TrianglePacket::Width; ++i) {
+        float e1[3], e2[3], tvec[3];
+        for (int k = 0; k < 3; ++k) {
+            e1[k] = packet.edge1[k][i];
+            e2[k] = packet.edge2[k][i];
+            tvec[k] = origin[k] - packet.p0[k][i];
+        }
+        float pvec[3] = { direction[1] * e2[2] - direction[2] * e2[1], direction[2] * e2[0] - direction[0] * e2[2],
+                          direction[0] * e2[1] - direction[1] * e2[0] };
+        float qvec[3] = { tvec[1] * e1[2] - tvec[2] * e1[1], tvec[2] * e1[0] - tvec[0] * e1[2], tvec[0] * e1[1] - tvec[1] * e1[0] };
+        float determinant = e1[0] * pvec[0] + e1[1] * pvec[1] + e1[2] * pvec[2];
+        float invDeterminant = 1.f / determinant;
+        u[i] = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * invDeterminant;
+        v[i] = (direction[0] * qvec[0] + direction[1] * qvec[1] + direction[2] * qvec[2]) * invDeterminant;
+        t[i] = (e2[0] * qvec[0] + e2[1] * qvec[1] + e2[2] * qvec[2]) * invDeterminant;
+        if ((determinant >= ParallelEpsilon || determinant <= -ParallelEpsilon) && u[i] >= 0.f && v[i] >= 0.f
+                && u[i] + v[i] <= 1.f && t[i] > tMin && t[i] < tMax)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#endif
+
+#if defined(__AVX__)
+
+static inline __m256 loadPair(const float* a, const float* b)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(a)), _mm_load_ps(b), 1);
+}
+
+/// Test a ray against the triangles of the two packets starting at \a packet, as intersectLanes4() does for one
+static inline int intersectLanes8(const TrianglePacket* packet, const float* origin, const float* direction, float tMin,
+                                  float tMax, float* t, float* u, float* v)
+{
+    __m256 o[3], d[3], p0[3], e1[3], e2[3];
+    for (int k = 0; k < 3; ++k) {
+        o[k] = _mm256_set1_ps(origin[k]);
+        d[k] = _mm256_set1_ps(direction[k]);
+        p0[k] = loadPair(packet[0].p0[k], packet[1].p0[k]);
+        e1[k] = loadPair(packet[0].edge1[k], packet[1].edge1[k]);
+        e2[k] = loadPair(packet[0].edge2[k], packet[1].edge2[k]);
+    }
+    __m256 pvec0 = _mm256_sub_ps(_mm256_mul_ps(d[1], e2[2]), _mm256_mul_ps(d[2], e2[1]));
+    __m256 pvec1 = _mm256_sub_ps(_mm256_mul_ps(d[2], e2[0]), _mm256_mul_ps(d[0], e2[2]));
+    __m256 pvec2 = _mm256_sub_ps(_mm256_mul_ps(d[0], e2[1]), _mm256_mul_ps(d[1], e2[0]));
+    __m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], pvec0), _mm256_mul_ps(e1[1], pvec1)), _mm256_mul_ps(e1[2], pvec2));
+    __m256 absDeterminant = _mm256_andnot_ps(_mm256_set1_ps(-0.f), determinant);
+    __m256 valid = _mm256_cmp_ps(absDeterminant, _mm256_set1_ps(ParallelEpsilon), _CMP_GE_OQ);
+    __m256 invDeterminant = _mm256_div_ps(_mm256_set1_ps(1.f), determinant);
+
+    __m256 tvec0 = _mm256_sub_ps(o[0], p0[0]), tvec1 = _mm256_sub_ps(o[1], p0[1]), tvec2 = _mm256_sub_ps(o[2], p0[2]);
+    __m256 uu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tvec0, pvec0), _mm256_mul_ps(tvec1, pvec1)), _mm256_mul_ps(tvec2, pvec2)), invDeterminant);
+    __m256 qvec0 = _mm256_sub_ps(_mm256_mul_ps(tvec1, e1[2]), _mm256_mul_ps(tvec2, e1[1]));
+    __m256 qvec1 = _mm256_sub_ps(_mm256_mul_ps(tvec2, e1[0]), _mm256_mul_ps(tvec0, e1[2]));
+    __m256 qvec2 = _mm256_sub_ps(_mm256_mul_ps(tvec0, e1[1]), _mm256_mul_ps(tvec1, e1[0]));
+    __m256 vv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], qvec0), _mm256_mul_ps(d[1], qvec1)), _mm256_mul_ps(d[2], qvec2)), invDeterminant);
+    __m256 tt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], qvec0), _mm256_mul_ps(e2[1], qvec1)), _mm256_mul_ps(e2[2], qvec2)), invDeterminant);
+
+    __m256 zero = _mm256_setzero_ps();
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(uu, zero, _CMP_GE_OQ), _mm256_cmp_ps(vv, zero, _CMP_GE_OQ)));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(uu, vv), _mm256_set1_ps(1.f), _CMP_LE_OQ));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tt, _mm256_set1_ps(tMin), _CMP_GT_OQ),
+                                                  _mm256_cmp_ps(tt, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+    _mm256_storeu_ps(t, tt);
+    _mm256_storeu_ps(u, uu);
+    _mm256_storeu_ps(v, vv);
+    return _mm256_movemask_ps(valid);
+}
+
+#endif
+
+static int intersectTriangles(const TrianglePacket* packets, int count, const float* origin, const float* direction,
+                              float tMin, float& t, float& u, float& v)
+{
+    float tLanes[8], uLanes[8], vLanes[8];
+    int index = -1;
+    for (int i = 0; i < count; ) {
+        int mask, lanes;
+#if defined(__AVX__)
+        if (i + 1 < count) {
+            mask = intersectLanes8(packets + i, origin, direction, tMin, t, tLanes, uLanes, vLanes);
+            lanes = 2 * TrianglePacket::Width;
+        } else
+#endif
+        {
+            mask = intersectLanes4(packets[i], origin, direction, tMin, t, tLanes, uLanes, vLanes);
+            lanes = TrianglePacket::Width;
+        }
+        // keep the nearest lane hit, the first one in case of equality as the scalar test does
+        for (; mask; mask &= mask - 1) {
+            int lane = 0;
+            while (!(mask & (1 << lane)))
+                ++lane;
+            if (tLanes[lane] < t) {
+                t = tLanes[lane];
+                u = uLanes[lane];
+                v = vLanes[lane];
+                index = i * TrianglePacket::Width + lane;
+            }
+        }
+        i += lanes / TrianglePacket::Width;
+    }
+    return index;
+}
+
+/* The spheres are tested in single precision, with the discriminant computed from the distance between
+   the center and the ray (r^2 - |oc - (d.oc) d|^2), which does not cancel when the sphere is far away. */
+
+#if defined(__SSE2__)
+
+/** Test a ray against the 4 spheres of \a packet starting at the lane \a i.
+  * \returns the bit mask of the lanes hit between \a tMin and \a tMax, their distances being returned in \a t */
+static inline int intersectSphereLanes4(const SpherePacket& packet, int i, const float* origin, const float* direction,
+                                        float tMin, float tMax, float* t)
+{
+    __m128 d[3], oc[3];
+    for (int k = 0; k < 3; ++k) {
+        d[k] = _mm_set1_ps(direction[k]);
+        oc[k] = _mm_sub_ps(_mm_set1_ps(origin[k]), _mm_load_ps(&packet.center[k][i]));
+    }
+    __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc[0], d[0]), _mm_mul_ps(oc[1], d[1])), _mm_mul_ps(oc[2], d[2]));
+    __m128 f0 = _mm_sub_ps(oc[0], _mm_mul_ps(b, d[0]));
+    __m128 f1 = _mm_sub_ps(oc[1], _mm_mul_ps(b, d[1]));
+    __m128 f2 = _mm_sub_ps(oc[2], _mm_mul_ps(b, d[2]));
+    __m128 discr = _mm_sub_ps(_mm_load_ps(&packet.radius2[i]),
+                              _mm_add_ps(_mm_add_ps(_mm_mul_ps(f0, f0), _mm_mul_ps(f1, f1)), _mm_mul_ps(f2, f2)));
+    __m128 valid = _mm_cmpge_ps(discr, _mm_setzero_ps());
+    __m128 discrSqrt = _mm_sqrt_ps(_mm_max_ps(discr, _mm_setzero_ps()));
+    // the smallest solution, or the greatest one if the smallest is before tMin
+    __m128 minusB = _mm_sub_ps(_mm_setzero_ps(), b);
+    __m128 t0 = _mm_sub_ps(minusB, discrSqrt), t1 = _mm_add_ps(minusB, discrSqrt);
+    __m128 first = _mm_cmpgt_ps(t0, _mm_set1_ps(tMin));
+    __m128 tt = _mm_or_ps(_mm_and_ps(first, t0), _mm_andnot_ps(first, t1));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, _mm_set1_ps(tMin)), _mm_cmplt_ps(tt, _mm_set1_ps(tMax))));
+    _mm_storeu_ps(t, tt);
+    return _mm_movemask_ps(valid);
+}
+
+#else
+
+static inline int intersectSphereLanes4(const SpherePacket& packet, int i, const float* origin, const float* direction,
+                                        float tMin, float tMax, float* t)
+{
+    int mask = 0;
+    for (int lane = 0; lane < 4; ++lane) {
+        float oc[3];
+        for (int k = 0; k < 3; ++k)
+            oc[k] = origin[k] - packet.center[k][i + lane];
+        float b = oc[0] * direction[0] + oc[1] * direction[1] + oc[2] * direction[2];
+        float f[3] = { oc[0] - b * direction[0], oc[1] - b * direction[1], oc[2] - b * direction[2] };
+        float discr = packet.radius2[i + lane] - (f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+        float discrSqrt = sqrtf(discr > 0.f ? discr : 0.f);
+        float t0 = (0.f - b) - discrSqrt, t1 = (0.f - b) + discrSqrt;
+        t[lane] = t0 > tMin ? t0 : t1;
+        if (discr >= 0.f && t[lane] > tMin && t[lane] < tMax)
+            mask |= 1 << lane;
+    }
+    return mask;
+}
+
+#endif
+
+#if defined(__AVX__)
+
+/// Test a ray against the 8 spheres of \a packet, as intersectSphereLanes4() does for 4 of them
+static inline int intersectSphereLanes8(const SpherePacket& packet, const float* origin, const float* direction, float tMin,
+                                        float tMax, float* t)
+{
+    __m256 d[3], oc[3];
+    for (int k = 0; k < 3; ++k) {
+        d[k] = _mm256_set1_ps(direction[k]);
+        oc[k] = _mm256_sub_ps(_mm256_set1_ps(origin[k]), _mm256_load_ps(packet.center[k]));
+    }
+    __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(oc[0], d[0]), _mm256_mul_ps(oc[1], d[1])), _mm256_mul_ps(oc[2], d[2]));
+    __m256 f0 = _mm256_sub_ps(oc[0], _mm256_mul_ps(b, d[0]));
+    __m256 f1 = _mm256_sub_ps(oc[1], _mm256_mul_ps(b, d[1]));
+    __m256 f2 = _mm256_sub_ps(oc[2], _mm256_mul_ps(b, d[2]));
+    __m256 discr = _mm256_sub_ps(_mm256_load_ps(packet.radius2),
+                                 _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(f0, f0), _mm256_mul_ps(f1, f1)), _mm256_mul_ps(f2, f2)));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 valid = _mm256_cmp_ps(discr, zero, _CMP_GE_OQ);
+    __m256 discrSqrt = _mm256_sqrt_ps(_mm256_max_ps(discr, zero));
+    __m256 minusB = _mm256_sub_ps(zero, b);
+    __m256 t0 = _mm256_sub_ps(minusB, discrSqrt), t1 = _mm256_add_ps(minusB, discrSqrt);
+    __m256 tt = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, _mm256_set1_ps(tMin), _CMP_GT_OQ));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tt, _mm256_set1_ps(tMin), _CMP_GT_OQ),
+                                                  _mm256_cmp_ps(tt, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+    _mm256_storeu_ps(t, tt);
+    return _mm256_movemask_ps(valid);
+}
+
+#endif
+
+static int intersectSpheres(const SpherePacket* packets, int count, const float* origin, const float* direction, float tMin,
+                            float& t)
+{
+    float tLanes[SpherePacket::Width];
+    int index = -1;
+    for (int i = 0; i < count; ++i) {
+#if defined(__AVX__)
+        int mask = intersectSphereLanes8(packets[i], origin, direction, tMin, t, tLanes);
+#else
+        int mask = intersectSphereLanes4(packets[i], 0, origin, direction, tMin, t, tLanes)
+                   | intersectSphereLanes4(packets[i], 4, origin, direction, tMin, t, tLanes + 4) << 4;
+#endif
+        // keep the nearest lane hit, the first one in case of equality
+        for (; mask; mask &= mask - 1) {
+            int lane = 0;
+            while (!(mask & (1 << lane)))
+                ++lane;
+            if (tLanes[lane] < t) {
+                t = tLanes[lane];
+                index = i * SpherePacket::Width + lane;
+            }
+        }
+    }
+    return index;
+}
+
+/* The tone mapping quantizes the values as the scalar code did: the sRGB curve is the exact one of
+   Color3f::toSRGB, and the values are truncated, so that the PNG files are unchanged. Only the clamping,
+   which leaves the values of [0,1] untouched, is added. */
+
+static inline float clampUnit(float value)
+{
+    // NaNs become 0
+    value = value > 0.f ? value : 0.f;
+    return value < 1.f ? value : 1.f;
+}
+
+static inline uint8_t quantize(float value)
+{
+    return uint8_t(int(clampUnit(value) * 255.f));
+}
+
+static void tonemap(const float* values, size_t count, uint8_t* result, bool srgb)
+{
+    if (!srgb) {
+        // without library calls, this loop is vectorized for the instruction set of the variant
+        for (size_t i = 0; i < count; ++i)
+            result[i] = quantize(values[i]);
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        float value = values[i];
+        result[i] = quantize(value <= 0.0031308f ? 12.92f * value : (1.0f + 0.055f) * powf(value, 1.0f / 2.4f) - 0.055f);
+    }
+}
+
+extern const Kernels table = {
+    KERNELS_ISA,
+    &intersectBoxes<4>,
+    &intersectBoxes<8>,
+    &intersectQuantizedBoxes<4>,
+    &intersectQuantizedBoxes<8>,
+    &intersectTriangles,
+    &intersectSpheres,
+    &tonemap
+};
+
+} // namespace KERNELS_NAMESPACE
@@ -0,0 +1,5 @@
+/* Kernels compiled for AVX2, see kernels.inl */
+
+#define KERNELS_NAMESPACE avx2
+#define KERNELS_ISA "avx2"
+#include "kernels.inl"
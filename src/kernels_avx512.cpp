@@ -0,0 +1,5 @@
+/* Kernels compiled for AVX-512 (F, VL, BW and DQ), see kernels.inl */
+
+#define KERNELS_NAMESPACE avx512
+#define KERNELS_ISA "avx512"
+#include "kernels.inl"
@@ -0,0 +1,5 @@
+/* Kernels compiled for the flags of the rest of the raytracer (SSE2 on x86-64), see kernels.inl */
+
+#define KERNELS_NAMESPACE generic
+#define KERNELS_ISA "generic"
+#include "kernels.inl"
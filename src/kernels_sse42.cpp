@@ -0,0 +1,5 @@
+/* Kernels compiled for SSE 4.2, see kernels.inl */
+
+#define KERNELS_NAMESPACE sse42
+#define KERNELS_ISA "sse4.2"
+#include "kernels.inl"
@@ -1,72 +1,39 @@
+
 #include "viewer.h"
-#include "mesh.h"
+#include "bvh.h"
 
 #include <filesystem/resolver.h>
 
-void render(Scene* scene, ImageBlock* result, std::string outputName, bool* done)
-{
-    if(!scene)
-        return;
-
-    clock_t t = clock();
-
-    const Camera& camera = *(scene->camera());
-    const Integrator& integrator = *(scene->integrator());
-    integrator.preprocess(scene);
-
-    float tanfovy2 = tan(camera.fovY()*0.5);    
-    int width = camera.vpWidth();
-    int height = camera.vpHeight();
-
-    Vector3f camX = camera.right() * tanfovy2 * camera.nearDist() * float { width } / float { height };
-    Vector3f camY = -camera.up() * tanfovy2 * camera.nearDist();
-    Vector3f camF = camera.direction() * camera.nearDist();
-
-    /// TODO:
-    ///  1. iterate over the image pixels
-    ///  2. generate a primary ray
-    ///  3. call the integartor to compute the color along this ray
-    ///  4. write this color in the result image
-
-    for (int pixelx = 0; pixelx < width; pixelx++) {
-        for (int pixely = 0; pixely < height; pixely++) {
-            
-            // Compute relative coordinates of pixel center in the image plane
-            float facteurX = -1 + 2 * (pixelx + .5f) / (width - 1);
-            float facteurY = -1 + 2 * (pixely + .5f) / (height - 1);
-
-            // Ray starting at camera origin towards the center of the pixel
-            Ray ray { camera.position(), (camF + facteurX * camX + facteurY * camY).normalized() };
-            ray.recursionLevel = integrator.maxRecursion();
-            Color3f pix_color = integrator.Li(scene,ray);
-            pix_color.fullClamp();
-            result->put(Vector2f ( pixelx, pixely ), pix_color);
-        }
-    }
-        
-
-    t = clock() - t;
-    std::cout << "Raytracing time : " << float(t)/CLOCKS_PER_SEC << "s"<<std::endl;
-    std::cout << "Number of mesh face intersection : " << Mesh::ms_itersection_count << std::endl;
-    *done = true;
-}
-
 int main(int argc, char *argv[])
 {
     getFileResolver()->prepend(DATA_DIR);
 
     try {
+        /* Parse the optional thread count and BVH cache, i.e. "mds3d_raytracer [--threads N] [--bvh-cache DIR] [file]" */
+        int nbThreads = getCoreCount();
+        std::string filename;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if ((arg == "--threads" || arg == "-t") && i + 1 < argc)
+                nbThreads = toInt(argv[++i]);
+            else if (arg == "--bvh-cache" && i + 1 < argc)
+                BVH::setCacheDirectory(argv[++i]);
+            else
+                filename = arg;
+        }
+
         nanogui::init();
         Viewer *screen = new Viewer();;
+        screen->setThreadCount(nbThreads);
 
-        if (argc == 2) {
+        if (!filename.empty()) {
             /* load file from the command line */
-            filesystem::path path(argv[1]);
+            filesystem::path path(filename);
 
             if(path.extension() == "scn") { // load scene file
-                screen->loadScene(argv[1]);
+                screen->loadScene(filename);
             }else if(path.extension() == "exr") { // load OpenEXR image
-                screen->loadImage(argv[1]);
+                screen->loadImage(filename);
             }
         }
 
@@ -4,152 +4,1012 @@
 #include "bvh.h"
 #include "common.h"
 
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <filesystem/resolver.h>
-#include <tiny_obj_loader.h>
+
+/* Header of the binary mesh files, see Mesh::saveBinary() */
+struct BinaryMeshHeader
+{
+    char magic[8];
+    uint32_t version;
+    /// size of a vertex record, to detect incompatible layouts
+    uint32_t vertexSize;
+    uint64_t vertexCount;
+    uint64_t faceCount;
+    /// offsets of the vertex and face sections from the beginning of the file
+    uint64_t vertexOffset;
+    uint64_t faceOffset;
+    /// bounding box of the vertices: minimal x, y, z then maximal x, y, z coordinates
+    float bounds[6];
+};
+
+static const char BinaryMeshMagic[8] = { 'M', 'D', 'S', '3', 'D', 'M', 'S', 'H' };
+static const uint32_t BinaryMeshVersion = 1;
+static const uint64_t BinaryMeshAlignment = 64;
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + BinaryMeshAlignment - 1) / BinaryMeshAlignment * BinaryMeshAlignment;
+}
 
 Mesh::Mesh(const PropertyList &propList)
-    : m_BVH(nullptr)
 {
     std::string filename = propList.getString("filename");
+    std::string split = propList.getString("bvh", "sah");
+    if (split == "sah")
+        m_bvhSplit = BVH::SplitSAH;
+    else if (split == "midpoint")
+        m_bvhSplit = BVH::SplitMidpoint;
+    else
+        throw RTException("Mesh: unknown BVH split method \"%s\" (expected sah or midpoint)", split);
+    m_bvhWidth = propList.getInteger("bvhWidth", 2);
+    if (m_bvhWidth != 2 && m_bvhWidth != 4 && m_bvhWidth != 8)
+        throw RTException("Mesh: unsupported BVH width %i (expected 2, 4 or 8)", m_bvhWidth);
+    m_bvhCompressed = propList.getBoolean("bvhCompressed", false);
+    if (m_bvhCompressed && m_bvhWidth == 2)
+        throw RTException("Mesh: only the BVHs of width 4 or 8 can be compressed");
     loadFromFile(filename);
     buildBVH();
 }
 
+std::shared_ptr<const Mesh> Mesh::loadShared(const PropertyList &propList)
+{
+    // the meshes are only referenced weakly, to be released with their last user
+    static std::map<std::string, std::weak_ptr<const Mesh>> sharedMeshes;
+    static std::mutex mutex;
+
+    filesystem::path filepath(propList.getString("filename"));
+    if (!filepath.is_absolute())
+        filepath = getFileResolver()->resolve(filepath);
+    std::string key = tfm::format("%s|%s|%i|%i", filepath.str(), propList.getString("bvh", "sah"),
+                                  propList.getInteger("bvhWidth", 2), propList.getBoolean("bvhCompressed", false));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const Mesh> mesh = sharedMeshes[key].lock();
+    if (!mesh) {
+        mesh = std::make_shared<Mesh>(propList);
+        sharedMeshes[key] = mesh;
+    }
+    return mesh;
+}
+
 void Mesh::loadFromFile(const std::string& filename)
 {
-    filesystem::path filepath = getFileResolver()->resolve(filename);
+    // the resolver only handles the paths relative to the directories of the data and of the scene
+    filesystem::path filepath(filename);
+    if (!filepath.is_absolute())
+        filepath = getFileResolver()->resolve(filename);
     std::ifstream is(filepath.str());
     if (is.fail())
         throw RTException("Unable to open mesh file \"%s\"!", filepath.str());
 
+    auto start = std::chrono::steady_clock::now();
     const std::string ext = filepath.extension();
     if(ext=="off" || ext=="OFF")
         loadOFF(filepath.str());
     else if(ext=="obj" || ext=="OBJ")
         loadOBJ(filepath.str());
-    else
+    else if(ext=="ply" || ext=="PLY")
+        loadPLY(filepath.str());
+    else if(ext=="bmesh")
+        loadBinary(filepath.str());
+    else {
         std::cerr << "Mesh: extension \'" << ext << "\' not supported." << std::endl;
+        return;
+    }
+
+    double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    size_t size = filepath.file_size();
+    std::cout << "Mesh: " << filepath.filename() << " (" << memString(size) << ") loaded in " << timeString(time, true)
+              << tfm::format(" (%.1f MB/s)", size / (std::max(time, 1e-3) * 1e3)) << std::endl;
 }
 
-void Mesh::loadOFF(const std::string& filename)
+namespace {
+
+/* Minimal number of bytes per thread of the parallel parsers */
+const size_t ParseGrainSize = 1 << 20;
+
+/// Part of a text file parsed by one thread, made of whole lines
+struct TextChunk
 {
-    std::ifstream in(filename.c_str(),std::ios::in);
-    if(!in)
-    {
-        std::cerr << "File not found " << filename << std::endl;
-        return;
+    const char* begin;
+    const char* end;
+    /// elements found by the counting pass (lines, vertices, normals, texture coordinates, triangles),
+    /// then replaced by their offsets within the whole file
+    int64_t counts[5] = { 0, 0, 0, 0, 0 };
+    /// error raised by the thread parsing the chunk
+    std::string error;
+    /// false if a face of the chunk uses normal or texture coordinate indices which differ from its vertex indices
+    bool aligned = true;
+};
+
+enum { LineCount, VertexCount, NormalCount, TexcoordCount, TriangleCount };
+
+/// Split [begin,end) into one chunk of whole lines per core, at most
+std::vector<TextChunk> splitLines(const char* begin, const char* end)
+{
+    size_t size = end - begin;
+    int chunkCount = int(std::max<size_t>(1, std::min<size_t>(getCoreCount(), size / ParseGrainSize)));
+    std::vector<TextChunk> chunks(chunkCount);
+    const char* p = begin;
+    for (int i = 0; i < chunkCount; ++i) {
+        chunks[i].begin = p;
+        if (i + 1 < chunkCount) {
+            p = std::max(p, begin + size * (i + 1) / chunkCount);
+            const char* eol = (const char*) memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+        } else
+            p = end;
+        chunks[i].end = p;
     }
+    return chunks;
+}
 
-    std::string header;
-    in >> header;
+/// Run \a f(chunk) on every chunk in parallel, and rethrow the first error raised by a thread
+template <typename Func>
+void parseChunks(std::vector<TextChunk>& chunks, const Func& f)
+{
+    parallelChunks(0, int(chunks.size()), int(chunks.size()), [&](int, int first, int last) {
+        for (int i = first; i < last; ++i) {
+            try {
+                f(chunks[i]);
+            } catch (const std::exception& e) {
+                chunks[i].error = e.what();
+            }
+        }
+    });
+    for (const TextChunk& chunk : chunks)
+        if (!chunk.error.empty())
+            throw RTException("%s", chunk.error);
+}
 
-    // check the header file
-    if(header != "OFF")
-    {
-        std::cerr << "Wrong header = " << header << std::endl;
-        return;
+/// Replace the \a k-th counts of the chunks by their offsets. \returns their total
+int64_t countsToOffsets(std::vector<TextChunk>& chunks, int k)
+{
+    int64_t total = 0;
+    for (TextChunk& chunk : chunks) {
+        int64_t count = chunk.counts[k];
+        chunk.counts[k] = total;
+        total += count;
     }
+    return total;
+}
 
-    int nofVertices, nofFaces, inull;
-    int nb, id0, id1, id2;
-    Vector3f v;
+inline const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    return p;
+}
 
-    in >> nofVertices >> nofFaces >> inull;
+inline const char* nextLine(const char* p, const char* end)
+{
+    const char* eol = (const char*) memchr(p, '\n', end - p);
+    return eol ? eol + 1 : end;
+}
 
-    for(int i=0 ; i<nofVertices ; ++i)
-    {
-        in >> v.x() >> v.y() >> v.z();
-        m_vertices.push_back(Vertex(v));
-    }
+inline bool isEndOfLine(const char* p, const char* end)
+{
+    return p == end || *p == '\n' || *p == '#';
+}
 
-    for(int i=0 ; i<nofFaces ; ++i)
-    {
-        in >> nb >> id0 >> id1 >> id2;
-        assert(nb==3);
-        m_faces.push_back(FaceIndex(id0, id1, id2));
+/// Parse the number at \a p, after some spaces, without any locale nor stream overhead
+template <typename T>
+inline const char* parseNumber(const char* p, const char* end, T& value)
+{
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+')
+        ++p;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        const char* eol = std::find_if(p, end, [](char c) { return c == '\n' || c == '\r'; });
+        throw RTException("invalid number in line \"%s\"", std::string(p, std::min(eol, p + 80)));
     }
+    return result.ptr;
+}
+
+/// Convert the 1-based or negative (relative to \a count) index of an OBJ file into a 0-based index
+inline int objIndex(int64_t index, int64_t count)
+{
+    int64_t result = index > 0 ? index - 1 : count + index;
+    if (index == 0 || result < 0 || result >= count)
+        throw RTException("invalid index %i (%i elements)", index, count);
+    return int(result);
+}
+
+} // namespace
+
+void Mesh::loadOFF(const std::string& filename)
+{
+    MappedFile file(filename);
+    const char* p = file.data();
+    const char* end = p + file.size();
+
+    // the header is the OFF keyword, then the number of vertices, faces and edges, after possible comments
+    auto nextToken = [&]() {
+        while (true) {
+            p = skipSpaces(p, end);
+            if (p < end && *p == '#')
+                p = nextLine(p, end);
+            else if (p < end && *p == '\n')
+                ++p;
+            else
+                return;
+        }
+    };
+    nextToken();
+    if (end - p < 3 || strncmp(p, "OFF", 3) != 0)
+        throw RTException("Mesh::loadOFF: \"%s\" does not start with the OFF keyword", filename);
+    p += 3;
+    int64_t nofVertices, nofFaces, nofEdges;
+    nextToken();
+    p = parseNumber(p, end, nofVertices);
+    p = parseNumber(p, end, nofFaces);
+    p = parseNumber(p, end, nofEdges);
+    p = nextLine(p, end);
+    if (nofVertices < 0 || nofFaces < 0 || nofVertices > std::numeric_limits<int>::max())
+        throw RTException("Mesh::loadOFF: invalid header in \"%s\"", filename);
 
-    in.close();
+    // the data lines are the vertices then the faces: count the lines of each chunk to know which ones it holds
+    auto isDataLine = [](const char* line, const char* end) {
+        return !isEndOfLine(skipSpaces(line, end), end);
+    };
+    std::vector<TextChunk> chunks = splitLines(p, end);
+    parseChunks(chunks, [&](TextChunk& chunk) {
+        for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+            chunk.counts[LineCount] += isDataLine(line, chunk.end);
+    });
+    if (countsToOffsets(chunks, LineCount) < nofVertices + nofFaces)
+        throw RTException("Mesh::loadOFF: \"%s\" is truncated", filename);
 
+    // count the triangles of the polygons, to know where to write them
+    parseChunks(chunks, [&](TextChunk& chunk) {
+        int64_t index = chunk.counts[LineCount];
+        for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+            if (!isDataLine(line, chunk.end))
+                continue;
+            if (index >= nofVertices && index < nofVertices + nofFaces) {
+                int size;
+                parseNumber(line, chunk.end, size);
+                chunk.counts[TriangleCount] += std::max(size - 2, 0);
+            }
+            ++index;
+        }
+    });
+    int64_t nbTriangles = countsToOffsets(chunks, TriangleCount);
+    if (nbTriangles > std::numeric_limits<int>::max())
+        throw RTException("Mesh::loadOFF: too many faces in \"%s\"", filename);
+
+    // parse the vertices and the faces in place, splitting the polygons into fans of triangles
+    m_vertices.resize(nofVertices);
+    m_faces.resize(nbTriangles);
+    parseChunks(chunks, [&](TextChunk& chunk) {
+        int64_t index = chunk.counts[LineCount];
+        int64_t triangle = chunk.counts[TriangleCount];
+        for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+            if (!isDataLine(line, chunk.end))
+                continue;
+            if (index < nofVertices) {
+                Point3f& position = m_vertices[index].position;
+                const char* q = parseNumber(line, chunk.end, position.x());
+                q = parseNumber(q, chunk.end, position.y());
+                parseNumber(q, chunk.end, position.z());
+            } else if (index < nofVertices + nofFaces) {
+                int size, ids[3];
+                const char* q = parseNumber(line, chunk.end, size);
+                for (int i = 0; i < size; ++i) {
+                    q = parseNumber(q, chunk.end, ids[std::min(i, 2)]);
+                    if (ids[std::min(i, 2)] < 0 || ids[std::min(i, 2)] >= nofVertices)
+                        throw RTException("invalid vertex index %i", ids[std::min(i, 2)]);
+                    if (i >= 2) {
+                        m_faces[triangle++] = FaceIndex(ids[0], ids[1], ids[2]);
+                        ids[1] = ids[2];
+                    }
+                }
+            }
+            ++index;
+        }
+    });
+    m_nbLoadedVertices = int(nofVertices);
+
+    useArrays();
     computeAABB();
 }
 
 void Mesh::loadOBJ(const std::string& filename)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string err, warn;
-    bool success = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str());
+    MappedFile file(filename);
+    std::vector<TextChunk> chunks = splitLines(file.data(), file.data() + file.size());
+
+    // count the elements of each chunk, so that the threads know where to write them
+    // and how to resolve the relative indices
+    parseChunks(chunks, [&](TextChunk& chunk) {
+        for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+            const char* p = skipSpaces(line, chunk.end);
+            if (chunk.end - p < 2 || (p[1] != ' ' && p[1] != '\t' && p[1] != 'n' && p[1] != 't'))
+                continue;
+            if (p[0] == 'v')
+                ++chunk.counts[p[1] == 'n' ? NormalCount : p[1] == 't' ? TexcoordCount : VertexCount];
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                int corners = 0;
+                for (p = skipSpaces(p + 1, chunk.end); !isEndOfLine(p, chunk.end); p = skipSpaces(p, chunk.end)) {
+                    ++corners;
+                    while (p < chunk.end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                        ++p;
+                }
+                chunk.counts[TriangleCount] += std::max(corners - 2, 0);
+            }
+        }
+    });
+    int64_t total[5];
+    for (int k = 0; k < 5; ++k)
+        total[k] = countsToOffsets(chunks, k);
+    if (total[VertexCount] > std::numeric_limits<int>::max() || total[TriangleCount] * 3 > std::numeric_limits<int>::max())
+        throw RTException("Mesh::loadOBJ: too many vertices or faces in \"%s\"", filename);
+
+    // parse the positions in place, the normals and texture coordinates aside, and the faces with the
+    // indices of their positions in place and those of their normals and texture coordinates aside
+    m_vertices.resize(total[VertexCount]);
+    m_faces.resize(total[TriangleCount]);
+    std::vector<Normal3f> normals(total[NormalCount]);
+    std::vector<Vector2f> texcoords(total[TexcoordCount]);
+    std::vector<FaceIndex> normalIds(total[NormalCount] > 0 ? total[TriangleCount] : 0, FaceIndex::Constant(-1));
+    std::vector<FaceIndex> texcoordIds(total[TexcoordCount] > 0 ? total[TriangleCount] : 0, FaceIndex::Constant(-1));
+    parseChunks(chunks, [&](TextChunk& chunk) {
+        int64_t counts[5];
+        std::copy(chunk.counts, chunk.counts + 5, counts);
+        for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+            const char* p = skipSpaces(line, chunk.end);
+            if (chunk.end - p < 2)
+                continue;
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                Point3f& position = m_vertices[counts[VertexCount]++].position;
+                p = parseNumber(p + 1, chunk.end, position.x());
+                p = parseNumber(p, chunk.end, position.y());
+                parseNumber(p, chunk.end, position.z());
+            } else if (p[0] == 'v' && p[1] == 'n') {
+                Normal3f& normal = normals[counts[NormalCount]++];
+                p = parseNumber(p + 2, chunk.end, normal.x());
+                p = parseNumber(p, chunk.end, normal.y());
+                parseNumber(p, chunk.end, normal.z());
+            } else if (p[0] == 'v' && p[1] == 't') {
+                Vector2f& texcoord = texcoords[counts[TexcoordCount]++];
+                p = parseNumber(p + 2, chunk.end, texcoord.x());
+                parseNumber(p, chunk.end, texcoord.y());
+            } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                // corners "v", "v/t", "v//n" or "v/t/n"
+                int ids[3][3];
+                int corner = 0;
+                for (p = skipSpaces(p + 1, chunk.end); !isEndOfLine(p, chunk.end); p = skipSpaces(p, chunk.end), ++corner) {
+                    int* id = ids[std::min(corner, 2)];
+                    int64_t index;
+                    p = parseNumber(p, chunk.end, index);
+                    id[0] = objIndex(index, counts[VertexCount]);
+                    id[1] = id[2] = -1;
+                    if (p < chunk.end && *p == '/') {
+                        if (p + 1 < chunk.end && p[1] != '/') {
+                            p = parseNumber(p + 1, chunk.end, index);
+                            id[1] = objIndex(index, counts[TexcoordCount]);
+                        } else
+                            ++p;
+                        if (p < chunk.end && *p == '/') {
+                            p = parseNumber(p + 1, chunk.end, index);
+                            id[2] = objIndex(index, counts[NormalCount]);
+                        }
+                    }
+                    chunk.aligned &= (id[1] < 0 || id[1] == id[0]) && (id[2] < 0 || id[2] == id[0]);
+                    if (corner >= 2) {
+                        int64_t triangle = counts[TriangleCount]++;
+                        m_faces[triangle] = FaceIndex(ids[0][0], ids[1][0], ids[2][0]);
+                        if (!texcoordIds.empty())
+                            texcoordIds[triangle] = FaceIndex(ids[0][1], ids[1][1], ids[2][1]);
+                        if (!normalIds.empty())
+                            normalIds[triangle] = FaceIndex(ids[0][2], ids[1][2], ids[2][2]);
+                        std::copy(ids[2], ids[2] + 3, ids[1]);
+                    }
+                }
+            }
+        }
+    });
+    m_nbLoadedVertices = int(m_faces.size() * 3);
+
+    bool aligned = std::all_of(chunks.begin(), chunks.end(), [](const TextChunk& chunk) { return chunk.aligned; })
+                && (normals.empty() || normals.size() == m_vertices.size())
+                && (texcoords.empty() || texcoords.size() == m_vertices.size());
+    if (aligned) {
+        // the normals and texture coordinates have the indices of the positions (or none): they
+        // are simply attached to the vertices
+        int nbVertices = int(m_vertices.size());
+        parallelChunks(0, nbVertices, getChunkCount(nbVertices, 1 << 16), [&](int, int first, int last) {
+            for (int i = first; i < last; ++i) {
+                if (!normals.empty())
+                    m_vertices[i].normal = normals[i];
+                if (!texcoords.empty())
+                    m_vertices[i].texcoord = texcoords[i];
+            }
+        });
+    } else {
+        // the corners of the faces which share the same position, texture coordinates and normal
+        // indices are welded into a single vertex, found in an open addressing hash table
+        VertexArray positions;
+        positions.swap(m_vertices);
+        m_vertices.reserve(positions.size());
+        size_t mask = 1;
+        while (mask < m_faces.size() * 6)
+            mask <<= 1;
+        --mask;
+        std::vector<int> table(mask + 1, -1);
+        std::vector<Eigen::Vector3i> corners; // indices of the welded vertices
+        corners.reserve(positions.size());
+        for (size_t f = 0; f < m_faces.size(); ++f) {
+            for (int v = 0; v < 3; ++v) {
+                Eigen::Vector3i corner(m_faces[f][v], texcoordIds.empty() ? -1 : texcoordIds[f][v],
+                                       normalIds.empty() ? -1 : normalIds[f][v]);
+                size_t slot = hashBytes(corner.data(), sizeof(corner)) & mask;
+                while (table[slot] >= 0 && corners[table[slot]] != corner)
+                    slot = (slot + 1) & mask;
+                if (table[slot] < 0) {
+                    table[slot] = int(m_vertices.size());
+                    Vertex vertex(positions[corner[0]].position);
+                    if (corner[1] >= 0)
+                        vertex.texcoord = texcoords[corner[1]];
+                    if (corner[2] >= 0)
+                        vertex.normal = normals[corner[2]];
+                    m_vertices.push_back(vertex);
+                    corners.push_back(corner);
+                }
+                m_faces[f][v] = table[slot];
+            }
+        }
+    }
+
+    useArrays();
+    computeAABB();
+}
+
+namespace {
+
+/// Scalar types of the properties of PLY files
+enum PlyType { PlyInvalid, PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64 };
+
+PlyType plyType(const std::string& name)
+{
+    static const char* names[][2] = {
+        { "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+        { "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+    };
+    for (int i = 0; i < 8; ++i)
+        if (name == names[i][0] || name == names[i][1])
+            return PlyType(PlyInt8 + i);
+    return PlyInvalid;
+}
+
+int plyTypeSize(PlyType type)
+{
+    static const int sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[type];
+}
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;
+    /// type of the number of items of a list property, PlyInvalid for the scalar properties
+    PlyType countType = PlyInvalid;
+};
+
+struct PlyElement
+{
+    std::string name;
+    int64_t count;
+    std::vector<PlyProperty> properties;
+
+    /// \returns the index of the property \a name, or -1
+    int find(const char* name) const {
+        for (size_t i = 0; i < properties.size(); ++i)
+            if (properties[i].name == name)
+                return int(i);
+        return -1;
+    }
+
+    /// \returns the size of the binary records, or 0 if they have list properties
+    int recordSize() const {
+        int size = 0;
+        for (const PlyProperty& property : properties) {
+            if (property.countType != PlyInvalid)
+                return 0;
+            size += plyTypeSize(property.type);
+        }
+        return size;
+    }
+
+    /// \returns the minimal size of the binary records, the lists being empty
+    int minRecordSize() const {
+        int size = 0;
+        for (const PlyProperty& property : properties)
+            size += plyTypeSize(property.countType != PlyInvalid ? property.countType : property.type);
+        return size;
+    }
+};
+
+template <typename T>
+inline T loadValue(const char* p, bool swap)
+{
+    char bytes[sizeof(T)];
+    memcpy(bytes, p, sizeof(T));
+    if (swap)
+        std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    memcpy(&value, bytes, sizeof(T));
+    return value;
+}
 
-    if (!success) {
-        throw RTException("Mesh::loadObj: error loading file %s: %s", filename, err);
+/// Read the binary value of type \a type at \a p, whose bytes are reversed if \a swap is true
+inline double readPlyValue(const char* p, PlyType type, bool swap)
+{
+    switch (type) {
+    case PlyInt8: return (int8_t) *p;
+    case PlyUInt8: return (uint8_t) *p;
+    case PlyInt16: return loadValue<int16_t>(p, swap);
+    case PlyUInt16: return loadValue<uint16_t>(p, swap);
+    case PlyInt32: return loadValue<int32_t>(p, swap);
+    case PlyUInt32: return loadValue<uint32_t>(p, swap);
+    case PlyFloat32: return loadValue<float>(p, swap);
+    case PlyFloat64: return loadValue<double>(p, swap);
+    default: return 0.;
     }
+}
+
+/// Properties of the vertex element used by the mesh: positions, normals, texture coordinates (-1 if missing)
+struct PlyVertexLayout
+{
+    int ids[8];
 
-    bool needNormals = false;
-
-    int face_idx = 0;
-
-    // Loop over shapes
-    for (size_t s = 0; s < shapes.size(); s++) {
-        // Loop over faces
-        size_t index_offset = 0;
-        for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-            int fv = shapes[s].mesh.num_face_vertices[f];
-            assert(fv == 3);
-
-            // Loop over vertices in the face.
-            for (size_t v = 0; v < fv; v++) {
-                // access to vertex
-                tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-
-                Point3f pos;
-                pos[0] = attrib.vertices[3*idx.vertex_index+0];
-                pos[1] = attrib.vertices[3*idx.vertex_index+1];
-                pos[2] = attrib.vertices[3*idx.vertex_index+2];
-
-                Vector3f n;
-                if (attrib.normals.size() > 0) {
-                    n[0] = attrib.normals[3*idx.normal_index+0];
-                    n[1] = attrib.normals[3*idx.normal_index+1];
-                    n[2] = attrib.normals[3*idx.normal_index+2];
-                } else {
-                    needNormals = true;
+    explicit PlyVertexLayout(const PlyElement& vertex) {
+        const char* names[8][3] = {
+            { "x" }, { "y" }, { "z" }, { "nx" }, { "ny" }, { "nz" },
+            { "u", "s", "texture_u" }, { "v", "t", "texture_v" }
+        };
+        for (int k = 0; k < 8; ++k) {
+            ids[k] = -1;
+            for (int j = 0; j < 3 && ids[k] < 0 && names[k][j]; ++j)
+                ids[k] = vertex.find(names[k][j]);
+        }
+        if (ids[0] < 0 || ids[1] < 0 || ids[2] < 0)
+            throw RTException("the vertices have no x, y and z properties");
+        for (int k = 0; k < 3; ++k)
+            if (vertex.properties[ids[k]].countType != PlyInvalid)
+                throw RTException("the coordinates of the vertices cannot be lists");
+    }
+
+    /// Set \a vertex from the values of the properties of a vertex record
+    void set(const double* values, Mesh::Vertex& vertex) const {
+        for (int k = 0; k < 3; ++k)
+            vertex.position[k] = float(values[ids[k]]);
+        if (ids[3] >= 0 && ids[4] >= 0 && ids[5] >= 0)
+            vertex.normal = Normal3f(float(values[ids[3]]), float(values[ids[4]]), float(values[ids[5]]));
+        if (ids[6] >= 0 && ids[7] >= 0)
+            vertex.texcoord = Vector2f(float(values[ids[6]]), float(values[ids[7]]));
+    }
+};
+
+/// \returns the index of the list of vertex indices of the faces
+int plyIndexProperty(const PlyElement& face)
+{
+    int id = face.find("vertex_indices");
+    if (id < 0)
+        id = face.find("vertex_index");
+    if (id < 0 || face.properties[id].countType == PlyInvalid)
+        throw RTException("the faces have no vertex_indices list");
+    return id;
+}
+
+} // namespace
+
+void Mesh::loadPLY(const std::string& filename)
+{
+    MappedFile file(filename);
+    const char* p = file.data();
+    const char* end = p + file.size();
+
+    // parse the header, up to the end_header line
+    enum { Ascii, BinaryLittleEndian, BinaryBigEndian } format = Ascii;
+    std::vector<PlyElement> elements;
+    bool magic = false, header = true;
+    while (header) {
+        if (p == end)
+            throw RTException("Mesh::loadPLY: \"%s\" has no end_header line", filename);
+        const char* eol = std::find(p, end, '\n');
+        std::vector<std::string> tokens = tokenize(std::string(p, std::find(p, eol, '\r') - p), " \t");
+        p = eol < end ? eol + 1 : end;
+        if (tokens.empty())
+            continue;
+        if (!magic) {
+            if (tokens[0] != "ply")
+                throw RTException("Mesh::loadPLY: \"%s\" does not start with the ply keyword", filename);
+            magic = true;
+        } else if (tokens[0] == "format" && tokens.size() >= 2) {
+            if (tokens[1] == "ascii")
+                format = Ascii;
+            else if (tokens[1] == "binary_little_endian")
+                format = BinaryLittleEndian;
+            else if (tokens[1] == "binary_big_endian")
+                format = BinaryBigEndian;
+            else
+                throw RTException("Mesh::loadPLY: unknown format \"%s\" in \"%s\"", tokens[1], filename);
+        } else if (tokens[0] == "element" && tokens.size() == 3) {
+            elements.push_back(PlyElement());
+            elements.back().name = tokens[1];
+            char* last;
+            elements.back().count = strtoll(tokens[2].c_str(), &last, 10);
+            if (*last != '\0' || elements.back().count < 0)
+                throw RTException("Mesh::loadPLY: invalid number \"%s\" of elements \"%s\" in \"%s\"", tokens[2], tokens[1], filename);
+        } else if (tokens[0] == "property" && !elements.empty()) {
+            PlyProperty property;
+            if (tokens.size() == 5 && tokens[1] == "list") {
+                property.countType = plyType(tokens[2]);
+                property.type = plyType(tokens[3]);
+                property.name = tokens[4];
+            } else if (tokens.size() == 3) {
+                property.type = plyType(tokens[1]);
+                property.name = tokens[2];
+            } else
+                property.type = PlyInvalid;
+            if (property.type == PlyInvalid || (tokens[1] == "list" && property.countType == PlyInvalid))
+                throw RTException("Mesh::loadPLY: invalid property in \"%s\"", filename);
+            elements.back().properties.push_back(property);
+        } else if (tokens[0] == "end_header")
+            header = false;
+    }
+
+    // a corrupted count must not allocate more memory than the file can fill: a binary record holds at least its
+    // scalars and the sizes of its lists, and an ascii one at least a character and a line break (but the last one)
+    uint64_t available = uint64_t(end - p) + (format == Ascii ? 1 : 0);
+    for (const PlyElement& element : elements) {
+        uint64_t minSize = element.properties.empty() ? 0 : format == Ascii ? 2 : uint64_t(element.minRecordSize());
+        if (minSize > 0 && uint64_t(element.count) > available / minSize)
+            throw RTException("Mesh::loadPLY: \"%s\" is too small for its %i elements \"%s\"", filename, element.count, element.name);
+        available -= uint64_t(element.count) * minSize;
+    }
+
+    const PlyElement *vertexElement = nullptr, *faceElement = nullptr;
+    for (const PlyElement& element : elements) {
+        if (element.name == "vertex")
+            vertexElement = &element;
+        else if (element.name == "face")
+            faceElement = &element;
+    }
+    if (!vertexElement || !faceElement)
+        throw RTException("Mesh::loadPLY: \"%s\" has no vertex or face element", filename);
+    if (vertexElement->count > std::numeric_limits<int>::max() || faceElement->count > std::numeric_limits<int>::max())
+        throw RTException("Mesh::loadPLY: too many vertices or faces in \"%s\"", filename);
+
+    try {
+        PlyVertexLayout layout(*vertexElement);
+        int indexProperty = plyIndexProperty(*faceElement);
+        m_vertices.resize(vertexElement->count);
+
+        // add the triangle fan of the polygon whose i-th vertex is ids[min(i,2)] to the faces
+        auto addCorner = [this](int i, int (&ids)[3], int nbVertices, int64_t& triangle) {
+            if (ids[std::min(i, 2)] < 0 || ids[std::min(i, 2)] >= nbVertices)
+                throw RTException("invalid vertex index %i", ids[std::min(i, 2)]);
+            if (i >= 2) {
+                m_faces[triangle++] = FaceIndex(ids[0], ids[1], ids[2]);
+                ids[1] = ids[2];
+            }
+        };
+
+        if (format == Ascii) {
+            // one line per element, like OFF files: count the lines of each chunk to know which ones it holds
+            auto isDataLine = [](const char* line, const char* end) {
+                return !isEndOfLine(skipSpaces(line, end), end);
+            };
+            std::vector<TextChunk> chunks = splitLines(p, end);
+            parseChunks(chunks, [&](TextChunk& chunk) {
+                for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+                    chunk.counts[LineCount] += isDataLine(line, chunk.end);
+            });
+            int64_t firstVertex = 0, firstFace = 0, lineCount = 0;
+            for (const PlyElement& element : elements) {
+                if (&element == vertexElement)
+                    firstVertex = lineCount;
+                else if (&element == faceElement)
+                    firstFace = lineCount;
+                lineCount += element.count;
+            }
+            if (countsToOffsets(chunks, LineCount) < lineCount)
+                throw RTException("the file is truncated");
+
+            // parse the values of the properties of an element line into \a values (0 for the lists), calling
+            // onList(k, size) for the k-th property if it is a list, then onItem(k, i, item) for each of its items
+            auto parseLine = [](const char* q, const char* end, const PlyElement& element, double* values,
+                                auto onList, auto onItem) {
+                for (size_t k = 0; k < element.properties.size(); ++k) {
+                    if (element.properties[k].countType == PlyInvalid) {
+                        q = parseNumber(q, end, values[k]);
+                        continue;
+                    }
+                    int size;
+                    q = parseNumber(q, end, size);
+                    onList(int(k), size);
+                    for (int i = 0; i < size; ++i) {
+                        double item;
+                        q = parseNumber(q, end, item);
+                        onItem(int(k), i, item);
+                    }
+                    values[k] = 0.;
                 }
+            };
+            auto ignoreList = [](int, int) { };
+            auto ignoreItem = [](int, int, double) { };
 
-                Vector2f tc = Vector2f::Zero();
-                if (attrib.texcoords.size() > 0) {
-                    tc[0] = attrib.texcoords[2*idx.texcoord_index+0];
-                    tc[1] = attrib.texcoords[2*idx.texcoord_index+1];
+            // count the triangles of the polygons, to know where to write them
+            parseChunks(chunks, [&](TextChunk& chunk) {
+                int64_t index = chunk.counts[LineCount];
+                std::vector<double> values(faceElement->properties.size());
+                for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+                    if (!isDataLine(line, chunk.end))
+                        continue;
+                    if (index >= firstFace && index < firstFace + faceElement->count)
+                        parseLine(line, chunk.end, *faceElement, values.data(), [&](int k, int size) {
+                            if (k == indexProperty)
+                                chunk.counts[TriangleCount] += std::max(size - 2, 0);
+                        }, ignoreItem);
+                    ++index;
                 }
-                m_vertices.push_back(Vertex(pos, n, tc));
+            });
+            m_faces.resize(countsToOffsets(chunks, TriangleCount));
+
+            // parse the vertices and the faces in place
+            int nbVertices = int(m_vertices.size());
+            parseChunks(chunks, [&](TextChunk& chunk) {
+                int64_t index = chunk.counts[LineCount];
+                int64_t triangle = chunk.counts[TriangleCount];
+                std::vector<double> values(std::max(vertexElement->properties.size(), faceElement->properties.size()));
+                for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end)) {
+                    if (!isDataLine(line, chunk.end))
+                        continue;
+                    if (index >= firstVertex && index < firstVertex + nbVertices) {
+                        parseLine(line, chunk.end, *vertexElement, values.data(), ignoreList, ignoreItem);
+                        layout.set(values.data(), m_vertices[index - firstVertex]);
+                    } else if (index >= firstFace && index < firstFace + faceElement->count) {
+                        int ids[3];
+                        parseLine(line, chunk.end, *faceElement, values.data(), ignoreList, [&](int k, int i, double item) {
+                            if (k == indexProperty) {
+                                ids[std::min(i, 2)] = int(item);
+                                addCorner(i, ids, nbVertices, triangle);
+                            }
+                        });
+                    }
+                    ++index;
+                }
+            });
+        } else {
+            bool bigEndianHost = false;
+            uint16_t one = 1;
+            memcpy(&bigEndianHost, &one, 1);
+            bigEndianHost = !bigEndianHost;
+            bool swap = (format == BinaryBigEndian) != bigEndianHost;
+
+            // skip the elements before the vertices and faces, and check the sizes of all the blocks
+            auto skipElement = [&](const char* q, const PlyElement& element) {
+                int size = element.recordSize();
+                if (size > 0) {
+                    if (size_t(end - q) < size_t(element.count) * size)
+                        throw RTException("the file is truncated");
+                    return q + element.count * size;
+                }
+                for (int64_t i = 0; i < element.count; ++i)
+                    for (const PlyProperty& property : element.properties) {
+                        int64_t count = 1;
+                        if (property.countType != PlyInvalid) {
+                            if (q + plyTypeSize(property.countType) > end)
+                                throw RTException("the file is truncated");
+                            count = int64_t(readPlyValue(q, property.countType, swap));
+                            q += plyTypeSize(property.countType);
+                        }
+                        if (count < 0 || size_t(end - q) < size_t(count) * plyTypeSize(property.type))
+                            throw RTException("the file is truncated");
+                        q += count * plyTypeSize(property.type);
+                    }
+                return q;
+            };
+            const char *vertexBlock = nullptr, *faceBlock = nullptr;
+            for (const PlyElement& element : elements) {
+                if (&element == vertexElement)
+                    vertexBlock = p;
+                else if (&element == faceElement)
+                    faceBlock = p;
+                p = skipElement(p, element);
             }
 
-            m_faces.push_back(FaceIndex(face_idx, face_idx+1, face_idx+2));
-            face_idx += 3;
-            index_offset += fv;
+            // the vertex records have a fixed size: they are converted in parallel
+            int recordSize = vertexElement->recordSize();
+            if (recordSize == 0)
+                throw RTException("the vertices cannot have list properties");
+            std::vector<int> offsets;
+            int offset = 0;
+            for (const PlyProperty& property : vertexElement->properties) {
+                offsets.push_back(offset);
+                offset += plyTypeSize(property.type);
+            }
+            int nbVertices = int(m_vertices.size());
+            parallelChunks(0, nbVertices, getChunkCount(nbVertices, 1 << 16), [&](int, int first, int last) {
+                std::vector<double> values(offsets.size());
+                for (int i = first; i < last; ++i) {
+                    const char* record = vertexBlock + size_t(i) * recordSize;
+                    for (size_t k = 0; k < offsets.size(); ++k)
+                        values[k] = readPlyValue(record + offsets[k], vertexElement->properties[k].type, swap);
+                    layout.set(values.data(), m_vertices[i]);
+                }
+            });
+
+            // the face records usually hold a list of 3 indices: they are read in a single pass,
+            // with a fast path for the triangles made of only this list
+            const PlyProperty& indices = faceElement->properties[indexProperty];
+            bool indexOnly = faceElement->properties.size() == 1;
+            int countSize = plyTypeSize(indices.countType), indexSize = plyTypeSize(indices.type);
+            m_faces.resize(faceElement->count);
+            int64_t triangle = 0;
+            const char* q = faceBlock;
+            for (int64_t f = 0; f < faceElement->count; ++f) {
+                for (size_t k = 0; k < faceElement->properties.size(); ++k) {
+                    const PlyProperty& property = faceElement->properties[k];
+                    if (property.countType == PlyInvalid) {
+                        q += plyTypeSize(property.type);
+                        continue;
+                    }
+                    int size = int(readPlyValue(q, property.countType, swap));
+                    q += countSize;
+                    if (int(k) != indexProperty) {
+                        q += size * plyTypeSize(property.type);
+                        continue;
+                    }
+                    if (triangle + std::max(size - 2, 0) > int64_t(m_faces.size()))
+                        m_faces.resize(std::max(m_faces.size() * 2, size_t(triangle + size)));
+                    if (indexOnly && size == 3 && indices.type == PlyInt32 && !swap) {
+                        FaceIndex& face = m_faces[triangle++];
+                        memcpy(face.data(), q, 12);
+                        if (face.minCoeff() < 0 || face.maxCoeff() >= nbVertices)
+                            throw RTException("invalid vertex index in face %i", f);
+                        q += 12;
+                        continue;
+                    }
+                    int ids[3];
+                    for (int i = 0; i < size; ++i, q += indexSize) {
+                        ids[std::min(i, 2)] = int(readPlyValue(q, indices.type, swap));
+                        addCorner(i, ids, nbVertices, triangle);
+                    }
+                }
+            }
+            m_faces.resize(triangle);
         }
+    } catch (const std::exception& e) {
+        throw RTException("Mesh::loadPLY: error loading \"%s\": %s", filename, e.what());
     }
+    m_nbLoadedVertices = int(m_vertices.size());
 
+    useArrays();
     computeAABB();
 }
 
 void Mesh::loadRawData(float* positions, int nbVertices, int* indices, int nbTriangles)
 {
     m_vertices.resize(nbVertices);
+    m_nbLoadedVertices = nbVertices;
     for(int i=0; i<nbVertices; ++i)
         m_vertices[i].position = Point3f::Map(positions+3*i);
     m_faces.resize(nbTriangles);
     for(int i=0; i<nbTriangles; ++i)
         m_faces[i] = Eigen::Vector3i::Map(indices+3*i);
 
+    useArrays();
     computeAABB();
 }
 
+void Mesh::loadBinary(const std::string& filename)
+{
+    std::unique_ptr<MappedFile> file(new MappedFile(filename));
+    BinaryMeshHeader header;
+    if (file->size() < sizeof(header))
+        throw RTException("Mesh::loadBinary: \"%s\" is not a binary mesh", filename);
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, BinaryMeshMagic, sizeof(BinaryMeshMagic)) != 0)
+        throw RTException("Mesh::loadBinary: \"%s\" is not a binary mesh", filename);
+    if (header.version != BinaryMeshVersion || header.vertexSize != sizeof(Vertex))
+        throw RTException("Mesh::loadBinary: \"%s\" has an unsupported version or layout, convert it again", filename);
+    // the offsets and counts are compared without being added, so that huge values cannot wrap around
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t elementSize) {
+        return offset <= file->size() && count <= (file->size() - offset) / elementSize;
+    };
+    if (header.vertexOffset % BinaryMeshAlignment != 0 || header.faceOffset % BinaryMeshAlignment != 0
+            || !fits(header.vertexOffset, header.vertexCount, sizeof(Vertex))
+            || !fits(header.faceOffset, header.faceCount, sizeof(FaceIndex))
+            || header.vertexCount > uint64_t(std::numeric_limits<int>::max())
+            || header.faceCount > uint64_t(std::numeric_limits<int>::max()))
+        throw RTException("Mesh::loadBinary: \"%s\" is truncated or corrupted", filename);
+
+    // the faces are checked once here, since the traversal and the shading index the vertices without checks
+    const FaceIndex* faces = reinterpret_cast<const FaceIndex*>(file->data() + header.faceOffset);
+    for (uint64_t f = 0; f < header.faceCount; ++f) {
+        for (int k = 0; k < 3; ++k) {
+            if (faces[f][k] < 0 || uint64_t(faces[f][k]) >= header.vertexCount)
+                throw RTException("Mesh::loadBinary: invalid vertex index %i in face %i of \"%s\"", faces[f][k], f, filename);
+        }
+    }
+
+    m_vertices.clear();
+    m_faces.clear();
+    m_vertexData = reinterpret_cast<const Vertex*>(file->data() + header.vertexOffset);
+    m_faceData = faces;
+    m_nbVertices = int(header.vertexCount);
+    m_nbFaces = int(header.faceCount);
+    m_nbLoadedVertices = m_nbVertices;
+    m_file = std::move(file);
+
+    // the bounding box is stored, so that the vertices are only read when they are needed
+    m_AABB = Eigen::AlignedBox3f(Vector3f(header.bounds[0], header.bounds[1], header.bounds[2]),
+                                 Vector3f(header.bounds[3], header.bounds[4], header.bounds[5]));
+    if (m_nbVertices == 0)
+        m_AABB.setNull();
+}
+
+void Mesh::saveBinary(const std::string& filename) const
+{
+    BinaryMeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BinaryMeshMagic, sizeof(BinaryMeshMagic));
+    header.version = BinaryMeshVersion;
+    header.vertexSize = sizeof(Vertex);
+    header.vertexCount = m_nbVertices;
+    header.faceCount = m_nbFaces;
+    header.vertexOffset = alignOffset(sizeof(header));
+    header.faceOffset = alignOffset(header.vertexOffset + header.vertexCount * sizeof(Vertex));
+    for (int k = 0; k < 3; ++k) {
+        header.bounds[k] = m_AABB.min()[k];
+        header.bounds[3 + k] = m_AABB.max()[k];
+    }
+
+    std::ofstream os(filename, std::ios::binary);
+    if (!os)
+        throw RTException("Mesh::saveBinary: unable to create \"%s\"", filename);
+    const char padding[BinaryMeshAlignment] = { 0 };
+    os.write((const char*) &header, sizeof(header));
+    os.write(padding, header.vertexOffset - sizeof(header));
+    os.write((const char*) m_vertexData, header.vertexCount * sizeof(Vertex));
+    os.write(padding, header.faceOffset - header.vertexOffset - header.vertexCount * sizeof(Vertex));
+    os.write((const char*) m_faceData, header.faceCount * sizeof(FaceIndex));
+    if (!os)
+        throw RTException("Mesh::saveBinary: error writing \"%s\"", filename);
+}
+
+void Mesh::useArrays()
+{
+    m_file.reset();
+    m_vertexData = m_vertices.data();
+    m_faceData = m_faces.data();
+    m_nbVertices = int(m_vertices.size());
+    m_nbFaces = int(m_faces.size());
+}
+
+void Mesh::unmap()
+{
+    if (!m_file)
+        return;
+    m_vertices.assign(m_vertexData, m_vertexData + m_nbVertices);
+    m_faces.assign(m_faceData, m_faceData + m_nbFaces);
+    useArrays();
+}
+
 Mesh::~Mesh()
 {
     if(m_BVH)
@@ -160,6 +1020,8 @@ void Mesh::makeUnitary()
 {
     // computes the lowest and highest coordinates of the axis aligned bounding box,
     // which are equal to the lowest and highest coordinates of the vertex positions.
+    unmap();
+
     Eigen::Vector3f lowest, highest;
     lowest.fill(std::numeric_limits<float>::max());   // "fill" sets all the coefficients of the vector to the same value
     highest.fill(-std::numeric_limits<float>::max());
@@ -185,8 +1047,8 @@ void Mesh::makeUnitary()
 void Mesh::computeAABB()
 {
     m_AABB.setNull();
-    for(VertexArray::iterator v_iter = m_vertices.begin() ; v_iter!=m_vertices.end() ; ++v_iter)
-        m_AABB.extend(v_iter->position);
+    for(int i=0; i<m_nbVertices; ++i)
+        m_AABB.extend(m_vertexData[i].position);
 }
 
 void Mesh::buildBVH()
@@ -194,10 +1056,13 @@ void Mesh::buildBVH()
     if(m_BVH)
         delete m_BVH;
     m_BVH = new BVH;
-    m_BVH->build(this, 10, 100);
+    m_BVH->build(this, 10, 100, m_bvhSplit, m_bvhWidth, m_bvhCompressed);
+    std::cout << "Mesh: BVH of " << nbFaces() << " faces " << (m_BVH->isFromCache() ? "loaded from the cache" : "built")
+              << " in " << timeString(m_BVH->getBuildTime(), true)
+              << " (" << memString(m_BVH->getMemoryUsage()) << ")" << std::endl;
 }
 
-long int Mesh::ms_itersection_count = 0;
+thread_local long int Mesh::ms_itersection_count = 0;
 
 bool Mesh::intersectFace(const Ray& ray, Hit& hit, int faceId) const
 {
@@ -244,53 +1109,53 @@ bool Mesh::intersectFace(const Ray& ray, Hit& hit, int faceId) const
     }
 
     auto t = edge2.dot(qvec)*inv_determinant;
-    if (t <= 0) {
+    if (t <= ray.tMin || t >= std::min(ray.tMax, hit.t())) {
         return false;
     }
     hit.setT(t);
-    
-    auto normal = ((1 - u - v)*v0.normal + u*v1.normal + v*v2.normal).normalized();
-    hit.setNormal(normal);
+    hit.setPrimitive(faceId, u, v);
 
     return true;
 }
 
 bool Mesh::intersect(const Ray& ray, Hit& hit) const
 {
-    float tMin, tMax;
-    Normal3f normal;
-    if( (!::intersect(ray, m_AABB, tMin, tMax, normal)) || tMin>hit.t())
-        return false;
-    Hit tmp_hit;
-    bool found_inter = false;
-    //std::cout  << "trying intersection with bvh:" << std::endl;
+    // the BVH starts with the bounding box of the mesh
     return m_BVH->intersect(ray, hit);
-    
-    
-    for (long unsigned int i = 0; i < m_faces.size(); ++i) {
-        if (intersectFace(ray, tmp_hit, i)) {
-            found_inter = true;
-            if (tmp_hit.t() < hit.t()) {
-                hit.setT(tmp_hit.t());
-                hit.setNormal(tmp_hit.normal());
-            }
-        }
-    }
-    //hit.setT(tMin);
-    //hit.setNormal(normal);
+}
 
-    return found_inter;
+bool Mesh::occluded(const Ray& ray) const
+{
+    return m_BVH->occluded(ray);
+}
+
+void Mesh::computeSurfaceInteraction(const Ray& ray, Hit& hit) const
+{
+    // interpolate the attributes of the vertices of the face
+    int faceId = hit.primitive();
+    float u = hit.barycentric().x(), v = hit.barycentric().y();
+    const Vertex& v0 = vertexOfFace(faceId, 0);
+    const Vertex& v1 = vertexOfFace(faceId, 1);
+    const Vertex& v2 = vertexOfFace(faceId, 2);
+    hit.setNormal(((1 - u - v)*v0.normal + u*v1.normal + v*v2.normal).normalized());
+    Vector2f uv = (1 - u - v)*v0.texcoord + u*v1.texcoord + v*v2.texcoord;
+    hit.setTextCoord(uv.x(), uv.y());
 }
 
 std::string Mesh::toString() const {
     return tfm::format(
         "Mesh[\n"
-        "  vertexCount = %i,\n"
+        "  vertexCount = %i (%i before welding),\n"
         "  triangleCount = %i,\n"
+        "  memory = %s (%s before welding),\n"
+        "  bvh = %s,\n"
         "  material = %s\n"
         "]",
-        m_vertices.size(),
-        m_faces.size(),
+        m_nbVertices, m_nbLoadedVertices,
+        m_nbFaces,
+        memString(m_nbVertices * sizeof(Vertex) + m_nbFaces * sizeof(FaceIndex)),
+        memString(m_nbLoadedVertices * sizeof(Vertex) + m_nbFaces * sizeof(FaceIndex)),
+        m_BVH ? indent(m_BVH->toString()) : std::string("null"),
         m_material ? indent(m_material->toString()) : std::string("null")
     );
 }
@@ -0,0 +1,53 @@
+
+#include "mesh.h"
+
+#include <filesystem/resolver.h>
+#include <chrono>
+
+/* Converts OFF, OBJ and PLY meshes into the binary format of Mesh::saveBinary(),
+   which the raytracer maps in memory instead of parsing it. */
+
+static void usage(const char *program)
+{
+    cerr << "Usage: " << program << " input.obj|input.off|input.ply [output.bmesh]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3 || argv[1][0] == '-') {
+        usage(argv[0]);
+        return argc == 2 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") ? 0 : -1;
+    }
+
+    /* By default, write the binary mesh next to the input file */
+    std::string inputName = argv[1];
+    std::string outputName = argc == 3 ? argv[2] : std::string();
+    if (outputName.empty()) {
+        outputName = inputName;
+        size_t lastdot = outputName.find_last_of(".");
+        if (lastdot != std::string::npos)
+            outputName.erase(lastdot, std::string::npos);
+        outputName += ".bmesh";
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        std::string ext = filesystem::path(inputName).extension();
+        if (ext != "obj" && ext != "OBJ" && ext != "off" && ext != "OFF" && ext != "ply" && ext != "PLY")
+            throw RTException("unsupported input format \"%s\" (expected obj, off or ply)", ext);
+
+        Mesh mesh;
+        mesh.loadFromFile(inputName);
+        if (mesh.nbFaces() == 0)
+            throw RTException("\"%s\" does not contain any face", inputName);
+        mesh.saveBinary(outputName);
+
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        cout << "Converted " << inputName << " (" << mesh.nbVertices() << " vertices, " << mesh.nbFaces()
+             << " faces) into " << outputName << " in " << timeString(time) << endl;
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -92,6 +92,7 @@ Object *loadFromXML(const std::string &filename)
     tags["light"]      = ELight;
     tags["camera"]     = ECamera;
     tags["integrator"] = EIntegrator;
+    tags["sampler"]    = ESampler;
     tags["boolean"]    = EBoolean;
     tags["integer"]    = EInteger;
     tags["float"]      = EFloat;
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include "plane.h"
@@ -36,28 +37,10 @@ bool Plane::intersect(const Ray& ray, Hit& hit) const
         auto D = plane_n.dot(plane_p);
         auto solution = (D - plane_n.dot(ray_o))/(denom);
         
-        // If solution is positive, the intersection occurs in front of the camera
-        if (solution >= 0) {
+        // The intersection must lie within the interval of the ray, and be closer than the hit
+        if (solution > ray.tMin && solution < std::min(ray.tMax, hit.t())) {
             hit.setT(solution);
-            hit.setNormal(plane_n);
-
-            // We define a vector space in our plane using orthogonal vectors
-            auto u = m_normal.cross(Vector3f {0,0,1} );
-            if (u == Vector3f{0,0,0}) {
-                // The normal was colinear to {1,0,0}. Pick another "random" vector 
-                u = m_normal.cross(Vector3f {0,1,0} );
-            }
-            u = u.normalized();
-            auto v = m_normal.cross(u).normalized();
-
-            // Using auto in this case triggers a bug in Eigen (AddressSanitizer: stack-use-after-scope)
-            //auto colinear_vector = ray.at(solution) - plane_p;
-            Vector3f colinear_vector = ray.at(solution) - plane_p;
-            auto p_u = u.dot(colinear_vector);
-            auto p_v = v.dot(colinear_vector);
-
-            hit.setTextCoord(p_u, p_v);
-            //hit.setNormal(plane_n.dot(-ray_d)*plane_n.normalized());
+            hit.setPrimitive(0);
             return true;
         }
     }
@@ -65,4 +48,27 @@ bool Plane::intersect(const Ray& ray, Hit& hit) const
     return false;
 }
 
+void Plane::computeSurfaceInteraction(const Ray& ray, Hit& hit) const
+{
+    hit.setNormal(m_normal);
+
+    // We define a vector space in our plane using orthogonal vectors
+    auto u = m_normal.cross(Vector3f {0,0,1} );
+    if (u == Vector3f{0,0,0}) {
+        // The normal was colinear to {1,0,0}. Pick another "random" vector 
+        u = m_normal.cross(Vector3f {0,1,0} );
+    }
+    u = u.normalized();
+    auto v = m_normal.cross(u).normalized();
+
+    // Using auto in this case triggers a bug in Eigen (AddressSanitizer: stack-use-after-scope)
+    //auto colinear_vector = ray.at(hit.t()) - m_position;
+    Vector3f colinear_vector = ray.at(hit.t()) - m_position;
+    auto p_u = u.dot(colinear_vector);
+    auto p_v = v.dot(colinear_vector);
+
+    hit.setTextCoord(p_u, p_v);
+    //hit.setNormal(m_normal.dot(-ray.direction)*m_normal.normalized());
+}
+
 REGISTER_CLASS(Plane, "plane")
@@ -0,0 +1,273 @@
+#include "render.h"
+#include "mesh.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+/// Per-frame camera setup shared by all the rendering threads
+struct CameraBasis
+{
+    CameraBasis(const Camera& camera)
+        : origin(camera.position()), width(camera.vpWidth()), height(camera.vpHeight())
+    {
+        float tanfovy2 = tan(camera.fovY()*0.5);
+        camX = camera.right() * tanfovy2 * camera.nearDist() * float { width } / float { height };
+        camY = -camera.up() * tanfovy2 * camera.nearDist();
+        camF = camera.direction() * camera.nearDist();
+    }
+
+    /// \returns the primary ray through the point (x,y) given in pixel coordinates
+    Ray generateRay(float x, float y) const
+    {
+        // Compute relative coordinates of the point in the image plane
+        float facteurX = -1 + 2 * x / (width - 1);
+        float facteurY = -1 + 2 * y / (height - 1);
+        return Ray { origin, (camF + facteurX * camX + facteurY * camY).normalized() };
+    }
+
+    Point3f origin;
+    Vector3f camX, camY, camF;
+    int width, height;
+};
+
+/// Running mean and variance of the luminance of the samples of a pixel (Welford's algorithm)
+struct PixelStatistics
+{
+    int count = 0;
+    float mean = 0.f, m2 = 0.f;
+    /// Whether the pixel needs more samples (see markNoisyPixels())
+    bool noisy = true;
+
+    void add(float value)
+    {
+        ++count;
+        float delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    /// \returns true if the relative standard error of the mean is below the threshold of \a sampler
+    bool converged(const Sampler& sampler) const
+    {
+        if (count < sampler.getMinSampleCount())
+            return false;
+        if (count >= sampler.getMaxSampleCount())
+            return true;
+        float variance = m2 / (count - 1);
+        return std::sqrt(variance / count) <= sampler.getThreshold() * std::max(mean, 1e-2f);
+    }
+};
+
+/// Flag the pixels of the rectangle (offset, size) of the image which need more samples:
+/// the pixels which have not converged, and their neighbours, since a few samples may all
+/// miss a small feature. \returns true if there is at least one such pixel
+static bool markNoisyPixels(std::vector<PixelStatistics>& stats, int width, const Sampler& sampler,
+                            const Point2i& offset, const Vector2i& size)
+{
+    auto pixelStats = [&](int x, int y) -> PixelStatistics& {
+        return stats[(offset.y() + y) * width + offset.x() + x];
+    };
+
+    for (int y = 0; y < size.y(); ++y)
+        for (int x = 0; x < size.x(); ++x)
+            pixelStats(x, y).noisy = false;
+
+    int maxSamples = sampler.getMaxSampleCount();
+    bool found = false;
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            if (pixelStats(x, y).converged(sampler))
+                continue;
+            for (int j = std::max(y - 1, 0); j <= std::min(y + 1, size.y() - 1); ++j) {
+                for (int i = std::max(x - 1, 0); i <= std::min(x + 1, size.x() - 1); ++i) {
+                    PixelStatistics& neighbour = pixelStats(i, j);
+                    neighbour.noisy = neighbour.count < maxSamples;
+                    found |= neighbour.noisy;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+/// Render the samples [firstSample, firstSample+sampleCount) of the pixel (pixelx,pixely) into
+/// \a block, and record their luminance in \a stats if it is not null
+static void renderPixel(const Scene* scene, const CameraBasis& basis, Sampler& sampler,
+                        int pixelx, int pixely, int firstSample, int sampleCount,
+                        ImageBlock& block, PixelStatistics* stats)
+{
+    const Integrator& integrator = *(scene->integrator());
+
+    sampler.startPixel(Point2i(pixelx, pixely), firstSample);
+    for (int i = 0; i < sampleCount; ++i) {
+        // Ray starting at camera origin towards the sample position within the pixel
+        Point2f sample = sampler.next2D();
+        Ray ray = basis.generateRay(pixelx + sample.x(), pixely + sample.y());
+        ray.recursionLevel = integrator.maxRecursion();
+        Color3f pix_color = integrator.Li(scene, ray);
+        pix_color.fullClamp();
+        // Box filter: the sample is accumulated in its pixel (whose center is given,
+        // since pixelx + sample.x() may round up to the next pixel in float)
+        block.put(Vector2f ( pixelx + .5f, pixely + .5f ), pix_color);
+        if (stats)
+            stats->add(pix_color.getLuminance());
+        sampler.advance();
+    }
+}
+
+/// Render the samples [firstSample, firstSample+sampleCount) of all the pixels of
+/// \a block (whose offset and size have been set by the BlockScheduler).
+/// In adaptive sampling, \a stats are the statistics of the whole image: only the noisy
+/// pixels are rendered, from their next sample on. \returns the number of samples rendered
+static long renderBlock(const Scene* scene, const CameraBasis& basis, Sampler& sampler,
+                        int firstSample, int sampleCount, ImageBlock& block,
+                        std::vector<PixelStatistics>* stats)
+{
+    const Point2i& offset = block.getOffset();
+    const Vector2i& size = block.getSize();
+    long total = 0;
+
+    block.clear();
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            int pixelx = offset.x() + x;
+            int pixely = offset.y() + y;
+            if (stats) {
+                PixelStatistics& pixelStats = (*stats)[pixely * basis.width + pixelx];
+                if (!pixelStats.noisy)
+                    continue;
+                renderPixel(scene, basis, sampler, pixelx, pixely, pixelStats.count, sampleCount, block, &pixelStats);
+            } else
+                renderPixel(scene, basis, sampler, pixelx, pixely, firstSample, sampleCount, block, nullptr);
+            total += sampleCount;
+        }
+    }
+    return total;
+}
+
+/// Render \a block with adaptive sampling: every pixel first gets the minimal number of
+/// samples, then the rest of the block's budget (its number of pixels times the sample
+/// count) is spent by batches on the noisy pixels. \returns the number of samples rendered
+static long renderBlockAdaptive(const Scene* scene, const CameraBasis& basis, Sampler& sampler,
+                                ImageBlock& block, std::vector<PixelStatistics>& stats)
+{
+    const Point2i& offset = block.getOffset();
+    const Vector2i& size = block.getSize();
+    int batch = sampler.getMinSampleCount();
+    int maxSamples = sampler.getMaxSampleCount();
+    long budget = long(size.x()) * size.y() * sampler.getSampleCount();
+    long total = renderBlock(scene, basis, sampler, 0, batch, block, &stats);
+
+    while (total < budget && markNoisyPixels(stats, basis.width, sampler, offset, size)) {
+        for (int y = 0; y < size.y() && total < budget; ++y) {
+            for (int x = 0; x < size.x() && total < budget; ++x) {
+                int pixelx = offset.x() + x;
+                int pixely = offset.y() + y;
+                PixelStatistics& pixelStats = stats[pixely * basis.width + pixelx];
+                if (!pixelStats.noisy)
+                    continue;
+                int count = (int) std::min<long>({ long(batch), budget - total, long(maxSamples - pixelStats.count) });
+                renderPixel(scene, basis, sampler, pixelx, pixely, pixelStats.count, count, block, &pixelStats);
+                total += count;
+            }
+        }
+    }
+    return total;
+}
+
+long render(Scene* scene, ImageBlock* result, std::string outputName, std::atomic<bool>* done, RenderOptions options)
+{
+    if(!scene)
+        return 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    const Camera& camera = *(scene->camera());
+    const Integrator& integrator = *(scene->integrator());
+    integrator.preprocess(scene);
+
+    CameraBasis basis(camera);
+
+    /* The camera gives the number of samples per pixel, the sampler their pattern */
+    scene->sampler()->setSampleCount(camera.sampleCount());
+    int sampleCount = scene->sampler()->getSampleCount();
+    bool adaptive = scene->sampler()->isAdaptive();
+
+    int nbThreads = options.nbThreads > 0 ? options.nbThreads : getCoreCount();
+
+    /* In progressive mode, each pass adds one sample to every pixel of the image,
+       otherwise a single pass renders all the samples, tile by tile.
+       In adaptive sampling, the passes go on (up to the maximal number of samples per
+       pixel) until all the pixels have converged or the total budget is spent */
+    int nbPasses = options.progressive ? (adaptive ? scene->sampler()->getMaxSampleCount() : sampleCount) : 1;
+    int passSamples = options.progressive ? 1 : sampleCount;
+    long budget = long(camera.outputSize().x()) * camera.outputSize().y() * sampleCount;
+
+    std::vector<PixelStatistics> stats;
+    if (adaptive)
+        stats.resize(camera.outputSize().x() * camera.outputSize().y());
+
+    auto stopped = [&]() {
+        return options.stop && options.stop->load(std::memory_order_relaxed);
+    };
+
+    std::atomic<long> intersectionCount(0), nodeCount(0), totalSamples(0);
+    std::string statistics;
+    int pass = 0;
+
+    for (; pass < nbPasses && !stopped() && totalSamples < budget; ++pass) {
+        /* Chop the image into tiles, dealt in spiral order to the worker threads,
+           which steal tiles from each other once they run out of work */
+        BlockScheduler scheduler(camera.outputSize(), BLOCK_SIZE, nbThreads);
+
+        auto worker = [&](int workerId) {
+            /* Each thread renders into its own block, which is then merged into the result */
+            ImageBlock block(Vector2i::Constant(BLOCK_SIZE));
+            std::unique_ptr<Sampler> sampler(scene->sampler()->clone());
+            Mesh::ms_itersection_count = 0;
+            BVH::ms_node_count = 0;
+            while (!stopped() && scheduler.next(workerId, block)) {
+                if (adaptive && !options.progressive)
+                    totalSamples += renderBlockAdaptive(scene, basis, *sampler, block, stats);
+                else
+                    totalSamples += renderBlock(scene, basis, *sampler, pass * passSamples, passSamples,
+                                                block, adaptive ? &stats : nullptr);
+                result->put(block);
+            }
+            intersectionCount += Mesh::ms_itersection_count;
+            nodeCount += BVH::ms_node_count;
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < nbThreads; ++i)
+            threads.emplace_back(worker, i);
+        worker(0);
+        for (auto& thread : threads)
+            thread.join();
+
+        statistics = scheduler.toString();
+        if (adaptive && options.progressive &&
+            !markNoisyPixels(stats, basis.width, *scene->sampler(), Point2i(0, 0), camera.outputSize()))
+            break; // every pixel has converged
+    }
+
+    float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Raytracing time : " << elapsed << "s (" << nbThreads << " threads, "
+              << sampleCount << " samples per pixel, " << kernels().isa << " kernels)" << std::endl;
+    if (options.progressive)
+        std::cout << "Progressive passes : " << pass << "/" << nbPasses << std::endl;
+    if (adaptive)
+        std::cout << "Adaptive sampling : " << totalSamples << " samples ("
+                  << float(totalSamples) / budget * 100.f << "% of the budget)" << std::endl;
+    if (stopped())
+        std::cout << "Raytracing stopped before completion" << std::endl;
+    std::cout << "Number of mesh face intersection : " << intersectionCount << std::endl;
+    std::cout << "Number of BVH node traversal : " << nodeCount << std::endl;
+    std::cout << statistics << std::endl;
+    *done = true;
+    return totalSamples;
+}
@@ -0,0 +1,153 @@
+
+#include "render.h"
+#include "parser.h"
+#include "bvh.h"
+#include "kernels.h"
+
+#include <filesystem/resolver.h>
+#include <chrono>
+#include <memory>
+
+/* Headless front-end of the raytracer: loads a scene, renders it and writes the
+   image, without creating any window or OpenGL context. The last line written
+   on the standard output is a JSON record of the timings, meant for scripts. */
+
+static void usage(const char *program)
+{
+    cerr << "Usage: " << program << " scene.scn [-o output.exr|output.png] [--threads N] [--spp N] [--progressive] [--bvh-cache DIR]" << endl;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// \returns \a value as a quoted JSON string, with its quotes, backslashes and control characters escaped
+static std::string jsonString(const std::string &value)
+{
+    std::string result = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\')
+            result += std::string("\\") + c;
+        else if (c == '\n')
+            result += "\\n";
+        else if (c == '\r')
+            result += "\\r";
+        else if (c == '\t')
+            result += "\\t";
+        else if ((unsigned char) c < 0x20)
+            result += tfm::format("\\u%04x", int(c));
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+int main(int argc, char *argv[])
+{
+    getFileResolver()->prepend(DATA_DIR);
+
+    std::string sceneName, outputName;
+    int nbThreads = 0, spp = 0;
+    bool progressive = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if ((arg == "-o" || arg == "--output") && hasValue)
+                outputName = argv[++i];
+            else if ((arg == "-t" || arg == "--threads") && hasValue)
+                nbThreads = toInt(argv[++i]);
+            else if (arg == "--spp" && hasValue)
+                spp = toInt(argv[++i]);
+            else if (arg == "--progressive")
+                progressive = true;
+            else if (arg == "--bvh-cache" && hasValue)
+                BVH::setCacheDirectory(argv[++i]);
+            else if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            } else if (arg[0] != '-' && sceneName.empty())
+                sceneName = arg;
+            else {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+    } catch (const std::exception &e) {
+        cerr << "Invalid argument: " << e.what() << endl;
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (sceneName.empty()) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* By default, write an OpenEXR image next to the scene file */
+    if (outputName.empty()) {
+        outputName = sceneName;
+        size_t lastdot = outputName.find_last_of(".");
+        if (lastdot != std::string::npos)
+            outputName.erase(lastdot, std::string::npos);
+        outputName += ".exr";
+    }
+
+    filesystem::path outputPath(outputName);
+    if (outputPath.extension() != "exr" && outputPath.extension() != "png") {
+        cerr << "Unsupported output format \"" << outputPath.extension() << "\" (expected exr or png)" << endl;
+        return -1;
+    }
+
+    if (nbThreads <= 0)
+        nbThreads = getCoreCount();
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        /* Load the scene */
+        filesystem::path scenePath(sceneName);
+        getFileResolver()->prepend(scenePath.parent_path());
+        std::unique_ptr<::Object> root(loadFromXML(sceneName));
+        if (root->getClassType() != ::Object::EScene)
+            throw RTException("\"%s\" does not describe a scene", sceneName);
+        Scene *scene = static_cast<Scene*>(root.get());
+        cout << scene->toString() << endl;
+        if (spp > 0)
+            scene->camera()->setSampleCount(spp);
+        double loadTime = elapsedMs(start);
+
+        /* Render it */
+        auto renderStart = std::chrono::steady_clock::now();
+        ImageBlock result(scene->camera()->outputSize());
+        result.clear();
+        std::atomic<bool> done(false);
+        RenderOptions options;
+        options.nbThreads = nbThreads;
+        options.progressive = progressive;
+        long samples = render(scene, &result, outputName, &done, options);
+        double renderTime = elapsedMs(renderStart);
+
+        /* Write the image, PNG files store sRGB values as the viewer does */
+        auto writeStart = std::chrono::steady_clock::now();
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        bitmap->save(outputPath, false, outputPath.extension() == "png");
+        double writeTime = elapsedMs(writeStart);
+
+        const Vector2i size = scene->camera()->outputSize();
+        int sampleCount = scene->sampler()->getSampleCount();
+        cout << tfm::format("{\"scene\": %s, \"output\": %s, \"width\": %i, \"height\": %i, "
+                            "\"spp\": %i, \"threads\": %i, \"samples\": %i, \"load_ms\": %.3f, "
+                            "\"render_ms\": %.3f, \"write_ms\": %.3f, \"total_ms\": %.3f, \"samples_per_s\": %.1f, \"isa\": %s}",
+                            jsonString(sceneName), jsonString(outputName), size.x(), size.y(),
+                            sampleCount, nbThreads, samples, loadTime, renderTime,
+                            writeTime, elapsedMs(start), samples / (renderTime * 1e-3), jsonString(kernels().isa))
+             << endl;
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
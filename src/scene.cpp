@@ -4,6 +4,7 @@
 
 #include <Eigen/Geometry>
 #include <filesystem/resolver.h>
+#include <chrono>
 
 Scene::Scene(const PropertyList& props) {
     m_backgroundColor = props.getColor("background", Color3f(0.6));
@@ -12,6 +13,7 @@ Scene::Scene(const PropertyList& props) {
 void Scene::clear()
 {
     m_shapeList.clear();
+    m_shapeBVH.clear();
     m_lightList.clear();
     if(m_camera)
         delete m_camera;
@@ -19,25 +21,24 @@ void Scene::clear()
     if(m_integrator)
         delete m_integrator;
     m_integrator = nullptr;
+    if(m_sampler)
+        delete m_sampler;
+    m_sampler = nullptr;
 }
 
-/** Search for the nearest intersection between the ray and the object list */
+/** Search for the nearest intersection between the ray and the shapes */
 void Scene::intersect(const Ray& ray, Hit& hit) const
 {
-    Hit tmp_hit;
-    /// TODO: iterate on the object list and test for intersection
-    ///       => if any, keep the closest one
-    for (auto & shape : m_shapeList) {
-        if ( shape->intersect(ray, tmp_hit) ) {
-            // If the ray intersects with something closer than what had
-            if ( tmp_hit.t() < hit.t() ) {
- 
-                hit=tmp_hit;
-                
-                hit.setShape(shape);
-            }
-        }
-    }
+    m_shapeBVH.intersect(ray, hit);
+    // Only compute the normal and texture coordinates of the nearest surface
+    if (hit.foundIntersection())
+        hit.shape()->computeSurfaceInteraction(ray, hit);
+}
+
+/** Visibility test, which stops at the first intersection within the interval of the ray */
+bool Scene::occluded(const Ray& ray) const
+{
+    return m_shapeBVH.occluded(ray);
 }
 
 void Scene::addChild(Object *obj) {
@@ -66,12 +67,31 @@ void Scene::addChild(Object *obj) {
             m_integrator = static_cast<Integrator *>(obj);
             break;
 
+        case ESampler:
+            if (m_sampler)
+                throw RTException("There can only be one sampler per scene!");
+            m_sampler = static_cast<Sampler *>(obj);
+            break;
+
         default:
             throw RTException("Scene::addChild(<%s>) is not supported!",
                 classTypeName(obj->getClassType()));
     }
 }
 
+void Scene::activate() {
+    /* By default, stratify the samples over the pixels */
+    if (!m_sampler)
+        m_sampler = static_cast<Sampler*>(ObjectFactory::createInstance("stratified", PropertyList()));
+
+    /* Top level of the acceleration structure, the meshes having their own BVH */
+    auto start = std::chrono::steady_clock::now();
+    m_shapeBVH.build(m_shapeList);
+    double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Scene: BVH of " << m_shapeBVH.nbBoundedShapes() << " shapes built in " << timeString(buildTime, true)
+              << " (" << m_shapeBVH.nbUnboundedShapes() << " unbounded shapes tested by every ray)" << std::endl;
+}
+
 std::string Scene::toString() const {
     std::string shapes;
     for (size_t i=0; i<m_shapeList.size(); ++i) {
@@ -92,6 +112,7 @@ std::string Scene::toString() const {
         "Scene[\n"
         "  background = %s,\n"
         "  integrator = %s,\n"
+        "  sampler = %s,\n"
         "  camera = %s,\n"
         "  shapes = {\n"
         "  %s  }\n"
@@ -100,6 +121,7 @@ std::string Scene::toString() const {
         "]",
         m_backgroundColor.toString(),
         indent(m_integrator->toString()),
+        indent(m_sampler->toString()),
         indent(m_camera->toString()),
         indent(shapes, 2),
         indent(lights, 2)
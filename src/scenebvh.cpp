@@ -0,0 +1,333 @@
+
+#include "scenebvh.h"
+#include "sphere.h"
+#include <algorithm>
+#include <limits>
+
+/* Relative costs of the traversal of an inner node and of a ray/shape test used by the SAH */
+static const float TraversalCost = 1.f;
+static const float IntersectionCost = 1.f;
+/* Maximal number of intersection tests of a leaf, a packet of spheres counting as one */
+static const int MaxLeafSize = 4;
+/* Size of the stack of the traversal, which bounds the depth of the tree */
+static const int TraversalStackSize = 64;
+
+static float surfaceArea(const Eigen::AlignedBox3f& box)
+{
+    if (box.isEmpty())
+        return 0.f;
+    Vector3f d = box.diagonal();
+    return 2.f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+/// Cost of the tests of a leaf of \a count shapes, whose \a nbSpheres spheres are tested by packets
+static float leafCost(int count, int nbSpheres)
+{
+    return IntersectionCost * (count - nbSpheres + (nbSpheres + SpherePacket::Width - 1) / SpherePacket::Width);
+}
+
+void SceneBVH::clear()
+{
+    m_nodes.clear();
+    m_shapes.clear();
+    m_unboundedShapes.clear();
+    m_packets.clear();
+}
+
+void SceneBVH::build(const std::vector<Shape*>& shapes)
+{
+    clear();
+    std::vector<const Shape*> bounded;
+    for (const Shape* shape : shapes) {
+        const Eigen::AlignedBox3f& box = shape->AABB();
+        // an empty shape cannot be hit
+        if (box.isEmpty())
+            continue;
+        if (!box.diagonal().allFinite()) {
+            m_unboundedShapes.push_back(shape);
+            continue;
+        }
+        bounded.push_back(shape);
+        m_boxes.push_back(box);
+        m_centroids.push_back(box.center());
+        m_isSphere.push_back(dynamic_cast<const Sphere*>(shape) != nullptr);
+    }
+    if (bounded.empty())
+        return;
+
+    m_order.resize(bounded.size());
+    for (size_t i = 0; i < m_order.size(); ++i)
+        m_order[i] = int(i);
+    m_nodes.reserve(2 * bounded.size() - 1);
+    m_nodes.emplace_back();
+    buildNode(0, 0, int(bounded.size()), 1);
+
+    m_shapes.reserve(bounded.size());
+    for (int i : m_order)
+        m_shapes.push_back(bounded[i]);
+    for (Node& node : m_nodes)
+        if (node.count > 0)
+            packSpheres(node);
+
+    // release the construction data
+    std::vector<Eigen::AlignedBox3f>().swap(m_boxes);
+    std::vector<Point3f>().swap(m_centroids);
+    std::vector<bool>().swap(m_isSphere);
+    std::vector<int>().swap(m_order);
+}
+
+void SceneBVH::buildNode(int nodeId, int start, int end, int depth)
+{
+    Eigen::AlignedBox3f box;
+    for (int i = start; i < end; ++i)
+        box.extend(m_boxes[m_order[i]]);
+    m_nodes[nodeId].box = box;
+
+    // there are few shapes, so every split between consecutive centroids is evaluated by the SAH
+    int count = end - start, nbSpheres = 0;
+    for (int i = start; i < end; ++i)
+        nbSpheres += m_isSphere[m_order[i]];
+    int bestAxis = -1, mid = start + count / 2;
+    float bestCost = leafCost(count, nbSpheres);
+    auto sortAlong = [&](int axis) {
+        std::sort(m_order.begin() + start, m_order.begin() + end,
+                  [&](int a, int b) { return m_centroids[a](axis) < m_centroids[b](axis); });
+    };
+    bool leaf = count == 1 || depth >= TraversalStackSize;
+    if (!leaf) {
+        float invArea = 1.f / std::max(surfaceArea(box), std::numeric_limits<float>::min());
+        std::vector<float> rightArea(count);
+        std::vector<int> rightSpheres(count + 1, 0);
+        for (int axis = 0; axis < 3; ++axis) {
+            sortAlong(axis);
+            Eigen::AlignedBox3f rightBox;
+            for (int i = count - 1; i > 0; --i) {
+                rightBox.extend(m_boxes[m_order[start + i]]);
+                rightArea[i] = surfaceArea(rightBox);
+                rightSpheres[i] = rightSpheres[i + 1] + m_isSphere[m_order[start + i]];
+            }
+            Eigen::AlignedBox3f leftBox;
+            int leftSpheres = 0;
+            for (int i = 1; i < count; ++i) {
+                leftBox.extend(m_boxes[m_order[start + i - 1]]);
+                leftSpheres += m_isSphere[m_order[start + i - 1]];
+                float cost = TraversalCost + invArea * (surfaceArea(leftBox) * leafCost(i, leftSpheres)
+                                                        + rightArea[i] * leafCost(count - i, rightSpheres[i]));
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    mid = start + i;
+                }
+            }
+        }
+        leaf = bestAxis < 0 && leafCost(count, nbSpheres) <= IntersectionCost * MaxLeafSize;
+    }
+
+    if (leaf) {
+        m_nodes[nodeId].first = start;
+        m_nodes[nodeId].count = count;
+        return;
+    }
+
+    // without any profitable split, the shapes are split in two halves along the largest axis
+    if (bestAxis < 0) {
+        Vector3f diagonal = box.diagonal();
+        bestAxis = 0;
+        if (diagonal.y() > diagonal(bestAxis)) bestAxis = 1;
+        if (diagonal.z() > diagonal(bestAxis)) bestAxis = 2;
+    }
+    sortAlong(bestAxis);
+
+    int firstChild = int(m_nodes.size());
+    m_nodes.resize(m_nodes.size() + 2);
+    m_nodes[nodeId].first = firstChild;
+    m_nodes[nodeId].count = 0;
+    buildNode(firstChild, start, mid, depth + 1);
+    buildNode(firstChild + 1, mid, end, depth + 1);
+}
+
+namespace {
+
+/// Ray data precomputed once per traversal for the slab tests, as in the BVH of the meshes
+struct TraversalRay
+{
+    TraversalRay(const Ray& ray)
+        : origin(ray.origin), invDirection(ray.direction.cwiseInverse())
+    {
+        for (int k = 0; k < 3; ++k)
+            sign[k] = invDirection[k] < 0.f;
+    }
+
+    Point3f origin;
+    Vector3f invDirection;
+    int sign[3];
+};
+
+/** Slab test between \a ray and \a box.
+  * \returns true if the ray enters the box before \a tMax, the entry distance being returned in \a tNear
+  */
+inline bool intersectBox(const Eigen::AlignedBox3f& box, const TraversalRay& ray, float tMax, float& tNear)
+{
+    const Eigen::Vector3f* bounds[2] = { &box.min(), &box.max() };
+    float tFar = tMax;
+    tNear = -std::numeric_limits<float>::max();
+    for (int k = 0; k < 3; ++k) {
+        float t0 = ((*bounds[ray.sign[k]])[k] - ray.origin[k]) * ray.invDirection[k];
+        float t1 = ((*bounds[1 - ray.sign[k]])[k] - ray.origin[k]) * ray.invDirection[k];
+        // written so that a NaN (ray within the plane of a slab) leaves the bounds unchanged
+        tNear = t0 > tNear ? t0 : tNear;
+        tFar = t1 < tFar ? t1 : tFar;
+    }
+    return tFar > 0.f && tNear <= tFar;
+}
+
+} // namespace
+
+void SceneBVH::packSpheres(Node& node)
+{
+    auto isSphere = [](const Shape* shape) { return dynamic_cast<const Sphere*>(shape) != nullptr; };
+    auto begin = m_shapes.begin() + node.first;
+    node.nbSpheres = int(std::stable_partition(begin, begin + node.count, isSphere) - begin);
+    node.firstPacket = int(m_packets.size());
+    m_packets.resize(m_packets.size() + nbPackets(node.nbSpheres));
+    for (int i = 0; i < nbPackets(node.nbSpheres) * SpherePacket::Width; ++i) {
+        SpherePacket& packet = m_packets[node.firstPacket + i / SpherePacket::Width];
+        int lane = i % SpherePacket::Width;
+        if (i < node.nbSpheres) {
+            const Sphere* sphere = static_cast<const Sphere*>(m_shapes[node.first + i]);
+            packet.set(lane, sphere->center().data(), sphere->radius());
+        } else
+            packet.clear(lane);
+    }
+}
+
+bool SceneBVH::intersect(const Ray& ray, Hit& hit) const
+{
+    // the shapes only update the hit if they are closer, which tightens the interval of the next ones
+    Ray tightRay(ray);
+    tightRay.tMax = std::min(ray.tMax, hit.t());
+    auto intersectShape = [&](const Shape* shape) {
+        if (!shape->intersect(tightRay, hit))
+            return false;
+        hit.setShape(shape);
+        tightRay.tMax = hit.t();
+        return true;
+    };
+
+    // the unbounded shapes first, their hits shortening the traversal
+    bool found = false;
+    for (const Shape* shape : m_unboundedShapes)
+        found |= intersectShape(shape);
+
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (m_nodes.empty() || !intersectBox(m_nodes[0].box, traversalRay, tightRay.tMax, tNear))
+        return found;
+
+    // far children still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        int nodeId;
+        float tNear;
+    };
+    StackEntry stack[TraversalStackSize];
+    int stackSize = 0;
+
+    int nodeId = 0;
+    while (true) {
+        const Node& node = m_nodes[nodeId];
+        if (node.count > 0) {
+            // the spheres update the hit as Sphere::intersect() does
+            float t = tightRay.tMax;
+            int sphere = node.nbSpheres > 0 ? intersectSpheres(node, tightRay, t) : -1;
+            if (sphere >= 0) {
+                hit.setT(t);
+                hit.setPrimitive(0);
+                hit.setShape(m_shapes[sphere]);
+                tightRay.tMax = t;
+                found = true;
+            }
+            for (int i = node.first + node.nbSpheres; i < node.first + node.count; ++i)
+                found |= intersectShape(m_shapes[i]);
+        } else {
+            int near = node.first, far = node.first + 1;
+            float tNear0, tNear1;
+            bool hit0 = intersectBox(m_nodes[near].box, traversalRay, tightRay.tMax, tNear0);
+            bool hit1 = intersectBox(m_nodes[far].box, traversalRay, tightRay.tMax, tNear1);
+            if (hit0 && hit1) {
+                if (tNear1 < tNear0) {
+                    std::swap(near, far);
+                    std::swap(tNear0, tNear1);
+                }
+                stack[stackSize++] = { far, tNear1 };
+                nodeId = near;
+                continue;
+            }
+            if (hit0 || hit1) {
+                nodeId = hit0 ? near : far;
+                continue;
+            }
+        }
+
+        // go on with the nearest pending node which is not behind the closest hit
+        while (stackSize > 0 && stack[stackSize - 1].tNear > tightRay.tMax)
+            --stackSize;
+        if (stackSize == 0)
+            break;
+        nodeId = stack[--stackSize].nodeId;
+    }
+    return found;
+}
+
+bool SceneBVH::occluded(const Ray& ray) const
+{
+    for (const Shape* shape : m_unboundedShapes)
+        if (shape->occluded(ray))
+            return true;
+
+    TraversalRay traversalRay(ray);
+    float tNear;
+    if (m_nodes.empty() || !intersectBox(m_nodes[0].box, traversalRay, ray.tMax, tNear))
+        return false;
+
+    // any hit ends the traversal, so the children are neither sorted nor culled by distance
+    int stack[TraversalStackSize];
+    int stackSize = 0;
+
+    int nodeId = 0;
+    while (true) {
+        const Node& node = m_nodes[nodeId];
+        if (node.count > 0) {
+            float t = ray.tMax;
+            if (node.nbSpheres > 0 && intersectSpheres(node, ray, t) >= 0)
+                return true;
+            for (int i = node.first + node.nbSpheres; i < node.first + node.count; ++i)
+                if (m_shapes[i]->occluded(ray))
+                    return true;
+        } else {
+            int first = node.first, second = node.first + 1;
+            bool hit0 = intersectBox(m_nodes[first].box, traversalRay, ray.tMax, tNear);
+            bool hit1 = intersectBox(m_nodes[second].box, traversalRay, ray.tMax, tNear);
+            if (hit0 && hit1)
+                stack[stackSize++] = second;
+            if (hit0 || hit1) {
+                nodeId = hit0 ? first : second;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            return false;
+        nodeId = stack[--stackSize];
+    }
+}
+
+std::string SceneBVH::toString() const
+{
+    return tfm::format("SceneBVH[\n"
+                       "  shapes = %i,\n"
+                       "  unbounded shapes = %i,\n"
+                       "  nodes = %i,\n"
+                       "  sphere packets = %i\n"
+                       "]",
+                       nbBoundedShapes(), nbUnboundedShapes(), m_nodes.size(), m_packets.size());
+}
@@ -16,4 +16,17 @@ void Shape::addChild(Object *obj) {
     }
 }
 
+bool Shape::occluded(const Ray& ray) const
+{
+    Hit hit;
+    return intersect(ray, hit);
+}
+
+const Eigen::AlignedBox3f& Shape::AABB() const
+{
+    static const Eigen::AlignedBox3f unbounded(Vector3f::Constant(-std::numeric_limits<float>::infinity()),
+                                               Vector3f::Constant(std::numeric_limits<float>::infinity()));
+    return unbounded;
+}
+
 REGISTER_CLASS(Shape, "shape")
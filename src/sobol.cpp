@@ -0,0 +1,67 @@
+#include "sampler.h"
+
+/**
+ * \brief Sobol low-discrepancy sampler
+ *
+ * The pixel position uses the first two dimensions of the Sobol sequence,
+ * which form a (0,2)-sequence: any power of two samples is stratified in
+ * every elementary interval of the pixel. Each pixel scrambles the digits
+ * of the sequence with its own random bits (random digit scrambling),
+ * which decorrelates neighbouring pixels. The other dimensions are
+ * independent.
+ */
+class Sobol : public Sampler
+{
+public:
+    Sobol(const PropertyList &propList)
+        : Sampler(propList) {}
+
+    Sampler *clone() const { return new Sobol(*this); }
+
+    float next1D() {
+        ++m_dimension;
+        return m_random.nextFloat();
+    }
+
+    Point2f next2D() {
+        if (m_dimension != 0) {
+            m_dimension += 2;
+            float x = m_random.nextFloat();
+            return Point2f(x, m_random.nextFloat());
+        }
+        m_dimension += 2;
+
+        uint32_t index = (uint32_t) m_sampleIndex;
+        return Point2f(toFloat(vanDerCorput(index, hash(m_pixelSeed, 0))),
+                       toFloat(sobol2(index, hash(m_pixelSeed, 1))));
+    }
+
+    std::string toString() const {
+        return tfm::format("Sobol[sampleCount = %i]", m_sampleCount);
+    }
+
+protected:
+    static float toFloat(uint32_t bits) {
+        return std::min(bits * 0x1p-32f, 0x1.fffffep-1f);
+    }
+
+    /// First dimension of the Sobol sequence (bit reversal of the index)
+    static uint32_t vanDerCorput(uint32_t n, uint32_t scramble) {
+        n = (n << 16) | (n >> 16);
+        n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+        n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+        n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+        n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+        return n ^ scramble;
+    }
+
+    /// Second dimension of the Sobol sequence
+    static uint32_t sobol2(uint32_t n, uint32_t scramble) {
+        for (uint32_t v = 1u << 31; n != 0; n >>= 1, v ^= v >> 1)
+            if (n & 1)
+                scramble ^= v;
+        return scramble;
+    }
+};
+
+REGISTER_CLASS(Sobol, "sobol")
@@ -0,0 +1,9 @@
+
+#include "spherepacket.h"
+#include "kernels.h"
+#include "ray.h"
+
+int intersectSpherePackets(const SpherePacket* packets, int count, const Ray& ray, float& t)
+{
+    return kernels().intersectSpheres(packets, count, ray.origin.data(), ray.direction.data(), ray.tMin, t);
+}
@@ -0,0 +1,68 @@
+#include "sampler.h"
+#include <cmath>
+
+/**
+ * \brief Stratified sampler
+ *
+ * The pixel is split into a grid of as many strata as samples, with the
+ * squarest strata possible: NxN strata for a square count, 4x2 for 8
+ * samples, and a single row for a prime count. Each sample is placed at a
+ * random position within its stratum. With a single sample per pixel, or if jittering is
+ * disabled, the samples are placed at the center of the strata. Only the
+ * pixel position is stratified, the other dimensions are independent.
+ * Beyond the sample count (in adaptive sampling), the strata are reused.
+ */
+class Stratified : public Sampler
+{
+public:
+    Stratified(const PropertyList &propList)
+        : Sampler(propList)
+    {
+        m_jitter = propList.getBoolean("jitter", true);
+    }
+
+    Sampler *clone() const { return new Stratified(*this); }
+
+    void setSampleCount(int sampleCount) {
+        m_sampleCount = std::max(sampleCount, 1);
+        // the number of rows is the largest divisor of the sample count not above its square root
+        m_rows = (int) std::sqrt(float(m_sampleCount));
+        while ((m_rows + 1) * (m_rows + 1) <= m_sampleCount)
+            ++m_rows;
+        while (m_sampleCount % m_rows != 0)
+            --m_rows;
+        m_columns = m_sampleCount / m_rows;
+    }
+
+    float next1D() {
+        ++m_dimension;
+        return m_random.nextFloat();
+    }
+
+    Point2f next2D() {
+        if (m_dimension != 0) {
+            m_dimension += 2;
+            float x = m_random.nextFloat();
+            return Point2f(x, m_random.nextFloat());
+        }
+        m_dimension += 2;
+
+        bool jitter = m_jitter && m_sampleCount > 1;
+        float jx = jitter ? m_random.nextFloat() : 0.5f;
+        float jy = jitter ? m_random.nextFloat() : 0.5f;
+        int stratum = m_sampleIndex % m_sampleCount;
+        return Point2f(std::min((stratum % m_columns + jx) / m_columns, 0x1.fffffep-1f),
+                       std::min((stratum / m_columns + jy) / m_rows, 0x1.fffffep-1f));
+    }
+
+    std::string toString() const {
+        return tfm::format("Stratified[sampleCount = %i (%ix%i strata), jitter = %s]",
+                           m_sampleCount, m_columns, m_rows, m_jitter ? "true" : "false");
+    }
+
+protected:
+    int m_columns = 1, m_rows = 1;
+    bool m_jitter;
+};
+
+REGISTER_CLASS(Stratified, "stratified")
@@ -0,0 +1,140 @@
+
+#include "mesh.h"
+#include "sampler.h"
+#include "trianglepacket.h"
+
+#include <chrono>
+
+/* Microbenchmark of the ray/triangle tests of the BVH leaves: the rays of a mesh are tested
+   against groups of consecutive faces, as large as leaves, by the scalar Mesh::intersectFace()
+   and by the SIMD kernel of the triangle packets, which must find the same hits. */
+
+static void usage(const char *program)
+{
+    cerr << "Usage: " << program << " mesh.obj|mesh.off|mesh.ply|mesh.bmesh [--rays N] [--group N]" << endl;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    std::string meshName;
+    int nbRays = 1 << 20, groupSize = 8;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--rays" && hasValue)
+                nbRays = toInt(argv[++i]);
+            else if (arg == "--group" && hasValue)
+                groupSize = toInt(argv[++i]);
+            else if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            } else if (arg[0] != '-' && meshName.empty())
+                meshName = arg;
+            else {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+    } catch (const std::exception &e) {
+        cerr << "Invalid argument: " << e.what() << endl;
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (meshName.empty() || nbRays <= 0 || groupSize <= 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    try {
+        Mesh mesh;
+        mesh.loadFromFile(meshName);
+        int nbGroups = mesh.nbFaces() / groupSize;
+        if (nbGroups == 0)
+            throw RTException("\"%s\" has less than %i faces", meshName, groupSize);
+
+        /* Pack each group of faces as the leaves of the BVH are */
+        int packetsPerGroup = (groupSize + TrianglePacket::Width - 1) / TrianglePacket::Width;
+        std::vector<TrianglePacket> packets(size_t(nbGroups) * packetsPerGroup);
+        for (int g = 0; g < nbGroups; ++g) {
+            for (int i = 0; i < packetsPerGroup * TrianglePacket::Width; ++i) {
+                TrianglePacket& packet = packets[g * packetsPerGroup + i / TrianglePacket::Width];
+                int lane = i % TrianglePacket::Width;
+                if (i < groupSize) {
+                    int faceId = g * groupSize + i;
+                    packet.set(lane, mesh.vertexOfFace(faceId, 0).position.data(), mesh.vertexOfFace(faceId, 1).position.data(),
+                               mesh.vertexOfFace(faceId, 2).position.data());
+                } else
+                    packet.clear(lane);
+            }
+        }
+
+        /* Rays from the outside of the mesh, aimed at a face of a random group */
+        PCG32 random;
+        std::vector<Ray> rays(nbRays);
+        std::vector<int> groups(nbRays);
+        Point3f center = mesh.AABB().center();
+        float radius = mesh.AABB().diagonal().norm();
+        for (int r = 0; r < nbRays; ++r) {
+            groups[r] = std::min(int(random.nextFloat() * nbGroups), nbGroups - 1);
+            int faceId = groups[r] * groupSize + std::min(int(random.nextFloat() * groupSize), groupSize - 1);
+            float a = random.nextFloat(), b = random.nextFloat();
+            Point3f target = (1 - a - b) * mesh.vertexOfFace(faceId, 0).position + a * mesh.vertexOfFace(faceId, 1).position
+                           + b * mesh.vertexOfFace(faceId, 2).position;
+            float z = 2 * random.nextFloat() - 1, phi = 2 * float(EIGEN_PI) * random.nextFloat();
+            float s = std::sqrt(std::max(0.f, 1 - z * z));
+            Point3f origin = center + radius * Vector3f(s * std::cos(phi), s * std::sin(phi), z);
+            rays[r] = Ray(origin, (target - origin).normalized());
+        }
+
+        /* Scalar tests, one face at a time */
+        std::vector<float> scalarT(nbRays);
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < nbRays; ++r) {
+            Hit hit;
+            for (int i = 0; i < groupSize; ++i)
+                mesh.intersectFace(rays[r], hit, groups[r] * groupSize + i);
+            scalarT[r] = hit.t();
+        }
+        double scalarTime = elapsedMs(start);
+
+        /* Tests of the packets */
+        std::vector<float> packetT(nbRays);
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < nbRays; ++r) {
+            float t = std::numeric_limits<float>::max(), u, v;
+            intersectTrianglePackets(&packets[groups[r] * packetsPerGroup], packetsPerGroup, rays[r], t, u, v);
+            packetT[r] = t;
+        }
+        double packetTime = elapsedMs(start);
+
+        /* Both must find the same hits, up to the precision of the computations */
+        int nbHits = 0, nbMismatches = 0;
+        for (int r = 0; r < nbRays; ++r) {
+            bool scalarHit = scalarT[r] < std::numeric_limits<float>::max();
+            bool packetHit = packetT[r] < std::numeric_limits<float>::max();
+            nbHits += scalarHit;
+            if (scalarHit != packetHit || (scalarHit && std::abs(scalarT[r] - packetT[r]) > 1e-4f * scalarT[r]))
+                ++nbMismatches;
+        }
+
+        double nbTests = double(nbRays) * groupSize;
+        cout << tfm::format("%i faces, %i rays against groups of %i faces (%i packets of %i), %.1f%% of hits\n",
+                            mesh.nbFaces(), nbRays, groupSize, packetsPerGroup, TrianglePacket::Width, 100.0 * nbHits / nbRays);
+        cout << tfm::format("scalar:  %s, %.1f M triangle tests/s\n", timeString(scalarTime, true), nbTests / (scalarTime * 1e3));
+        cout << tfm::format("packets: %s, %.1f M triangle tests/s (%.2fx)\n", timeString(packetTime, true),
+                            nbTests / (packetTime * 1e3), scalarTime / packetTime);
+        cout << tfm::format("%i mismatching rays", nbMismatches) << endl;
+        return nbMismatches * 1000 > nbRays ? -1 : 0;
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,9 @@
+
+#include "trianglepacket.h"
+#include "kernels.h"
+#include "ray.h"
+
+int intersectTrianglePackets(const TrianglePacket* packets, int count, const Ray& ray, float& t, float& u, float& v)
+{
+    return kernels().intersectTriangles(packets, count, ray.origin.data(), ray.direction.data(), ray.tMin, t, u, v);
+}
@@ -1,20 +1,20 @@
 #include "viewer.h"
 
 #include "parser.h"
+#include "render.h"
 
 #include <filesystem/resolver.h>
 #include <nanogui/slider.h>
 #include <nanogui/checkbox.h>
 #include <nanogui/button.h>
 #include <nanogui/layout.h>
-#include <thread>
-
-extern void render(Scene* scene, ImageBlock* result, std::string outputName, bool* done);
 
 Viewer::Viewer() :
     nanogui::Screen(Vector2i(512,512+50), "Raytracer")
 {
     m_renderingDone = true;
+    m_threadCount = getCoreCount();
+    m_stopRendering = false;
 
     /* Add some UI elements to adjust the exposure value */
     using namespace nanogui;
@@ -93,6 +93,7 @@ Viewer::Viewer() :
 
 Viewer::~Viewer()
 {
+    stopRendering();
     m_tonemapProgram.free();
 }
 
@@ -192,7 +193,7 @@ void Viewer::loadScene(const std::string& filename)
 
         if (path.extension() != "scn")
             return;
-        m_renderingDone = true;
+        stopRendering();
         if(m_resultImage) {
             delete m_resultImage;
             m_resultImage = nullptr;
@@ -222,7 +223,10 @@ void Viewer::loadScene(const std::string& filename)
 
 void Viewer::loadImage(const std::string &filename)
 {
+    stopRendering();
     m_curentFilename = filename;
+    if(m_resultImage)
+        delete m_resultImage;
     Bitmap bitmap(filename);
     m_resultImage = new ImageBlock(Eigen::Vector2i(bitmap.cols(), bitmap.rows()));
     m_resultImage->fromBitmap(bitmap);
@@ -253,26 +257,14 @@ bool Viewer::keyboardEvent(int key, int scancode, int action, int modifiers)
             return true;
         }
         case GLFW_KEY_R:
+        case GLFW_KEY_P:
         {
-            if(m_scene && m_renderingDone) {
-                m_renderingDone = false;
-                /* Determine the filename of the output bitmap */
-                std::string outputName = m_curentFilename;
-                size_t lastdot = outputName.find_last_of(".");
-                if (lastdot != std::string::npos)
-                    outputName.erase(lastdot, std::string::npos);
-                outputName += ".exr";
-
-                /* Allocate memory for the entire output image */
-                if(m_resultImage)
-                    delete m_resultImage;
-                m_resultImage = new ImageBlock(m_scene->camera()->outputSize());
-
-                std::thread render_thread(render,m_scene,m_resultImage,outputName,&m_renderingDone);
-                render_thread.detach();
-                m_button1->setEnabled(true);
-                m_button2->setEnabled(true);
-            }
+            /* R renders the image tile by tile, P progressively, one sample per pixel
+               and per pass. Pressing either key during a rendering stops it */
+            if(m_renderThread.joinable() && !m_renderingDone)
+                stopRendering();
+            else if(m_scene)
+                startRendering(key == GLFW_KEY_P);
             return true;
         }
         case GLFW_KEY_ESCAPE:
@@ -284,6 +276,43 @@ bool Viewer::keyboardEvent(int key, int scancode, int action, int modifiers)
     return Screen::keyboardEvent(key,scancode,action,modifiers);
 }
 
+void Viewer::startRendering(bool progressive)
+{
+    stopRendering();
+    m_renderingDone = false;
+    m_stopRendering = false;
+
+    /* Determine the filename of the output bitmap */
+    std::string outputName = m_curentFilename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
+    outputName += ".exr";
+
+    /* Allocate memory for the entire output image */
+    if(m_resultImage)
+        delete m_resultImage;
+    m_resultImage = new ImageBlock(m_scene->camera()->outputSize());
+    m_resultImage->clear();
+
+    RenderOptions options;
+    options.nbThreads = m_threadCount;
+    options.progressive = progressive;
+    options.stop = &m_stopRendering;
+    m_renderThread = std::thread(render,m_scene,m_resultImage,outputName,&m_renderingDone,options);
+    m_button1->setEnabled(true);
+    m_button2->setEnabled(true);
+}
+
+void Viewer::stopRendering()
+{
+    if(m_renderThread.joinable()) {
+        m_stopRendering = true;
+        m_renderThread.join();
+    }
+    m_renderingDone = true;
+}
+
 bool Viewer::dropEvent(const std::vector<std::string> &filenames)
 {
     // only tries to load the first file
@@ -35,12 +35,10 @@ public:
                 float light_dist;
                 // Vector from intersect point + Epsilon to the light
                 Ray shadow_ray { ray_o, light->direction(ray_o, &light_dist) };
-                Hit shadow_hit;
-                scene->intersect(shadow_ray, shadow_hit);
+                shadow_ray.tMax = light_dist;
 
-
-                // If there is no object between the light and the intersection point, then the light hits our point. We here use an inclusive inequality to consider the case where the intersection happens far enough so that shadow_hit.t() and light_dist are both infinite
-                if (shadow_hit.t() >= light_dist) {
+                // If there is no object between the light and the intersection point, then the light hits our point
+                if (!scene->occluded(shadow_ray)) {
                     Vector3f light_dir = light->direction(intersect_point);
 
                     // Calling brdf method without considering last uv parameter used later for textures